@@ -0,0 +1,111 @@
+/*
+ * backend - choose the fastest implementation for this cpu at runtime
+ *
+ * the assembler routines enabled in config.mk are only linked in, which
+ * one is used depends on the cpu features found by cpuid. the choice can
+ * be overwritten with the environment variable SFET_BACKEND.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#if defined(__x86_64__)
+  #include <cpuid.h>
+#endif
+
+#include "serpent.h"
+#include "poly1305.h"
+#include "backend.h"
+
+
+/* sorted from fastest to slowest */
+static const struct backend backends[] = {
+#ifdef USE_ASM_AVX2
+	{ "avx2", CPU_AVX2, serpent16x_ctr, 16,
+	  poly1305_setkey_avx2, poly1305_update_avx2 },
+#endif
+#ifdef USE_ASM_AVX
+	{ "avx", CPU_AVX, serpent8x_ctr, 8,
+	  poly1305_setkey, poly1305_update },
+#endif
+	{ "generic", 0, NULL, 0,
+	  poly1305_setkey, poly1305_update },
+};
+
+static const int backends_num = sizeof(backends) / sizeof(backends[0]);
+
+/* generic until backend_init is called */
+const struct backend *backend = &backends[backends_num-1];
+
+
+
+#if defined(__x86_64__)
+
+int
+cpu_features(void)
+{
+	unsigned int a, b, c, d;
+	int features = 0;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+
+	/* avx needs support from the os to save the ymm registers */
+	if (!(c & bit_OSXSAVE) || !(c & bit_AVX))
+		return 0;
+
+	__asm__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+	if ((a & 0x6) != 0x6)
+		return 0;
+
+	features |= CPU_AVX;
+
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, a, b, c, d);
+		if (b & bit_AVX2)
+			features |= CPU_AVX2;
+	}
+
+	return features;
+}
+
+#else
+
+int
+cpu_features(void)
+{
+	return 0;
+}
+
+#endif
+
+
+/*
+ * backend_init - select backend by name or the fastest one if name is NULL
+ */
+int
+backend_init(const char *name)
+{
+	int features = cpu_features();
+	int i;
+
+	for (i = 0; i < backends_num; i++) {
+		if (name != NULL && strcmp(name, backends[i].name) != 0)
+			continue;
+
+		if ((backends[i].cpu & features) != backends[i].cpu) {
+			if (name == NULL)
+				continue;
+
+			warnx("backend %s is not supported by this cpu", name);
+			return -1;
+		}
+
+		backend = &backends[i];
+		return 0;
+	}
+
+	warnx("unknown backend: %s", name);
+	return -1;
+}
@@ -0,0 +1,34 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "poly1305.h"
+
+/* cpu features */
+#define CPU_AVX		0x01
+#define CPU_AVX2	0x02
+
+
+struct backend {
+	const char	*name;
+	int		 cpu;		/* required cpu features */
+
+	/* serpent counter mode for ctr_blocks blocks at once, may be NULL */
+	void		(*ctr)(uint8_t *dst, const uint8_t *src,
+			       const uint32_t *expkey, uint8_t *ctr);
+	size_t		 ctr_blocks;
+
+	void		(*poly1305_setkey)(struct poly1305 *ctx,
+					   const uint8_t r[16]);
+	void		(*poly1305_update)(struct poly1305 *ctx,
+					   const uint8_t *data, size_t len);
+};
+
+extern const struct backend	*backend;
+
+int	cpu_features(void);
+int	backend_init(const char *name);
+
+#endif
@@ -1,18 +1,92 @@
+/*
+ * buffer - aligned data buffers
+ *
+ * big buffers are mapped 2 MiB aligned and we ask for transparent huge
+ * pages. this saves page faults and tlb misses when the crypto code runs
+ * over a whole chunk. the reserved hugetlb pool is left alone, it is
+ * usually set aside for other services.
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+#endif
+
+#include <sys/mman.h>
+
+#include <stdint.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include "burn.h"
 #include "buffer.h"
 
+
+/*
+ * hugemap - map len bytes (a multiple of HUGEPAGE_SIZE) aligned to a huge
+ * page, returns NULL if not possible
+ */
+static void *
+hugemap(size_t len)
+{
+	uint8_t *p, *start;
+	size_t head;
+
+	/* map more and cut off what's outside the aligned area */
+	p = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	head = (HUGEPAGE_SIZE - (uintptr_t)p % HUGEPAGE_SIZE) % HUGEPAGE_SIZE;
+	start = p + head;
+
+	if (head > 0)
+		munmap(p, head);
+	munmap(start + len, HUGEPAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+	madvise(start, len, MADV_HUGEPAGE);
+#endif
+
+	return start;
+}
+
+
 struct buffer *
 buffer_alloc(size_t size)
 {
 	struct buffer *bufp;
+	void *data;
+	size_t maplen;
+	int rc;
 
-	bufp = malloc(sizeof(struct buffer) + size);
+	bufp = malloc(sizeof(struct buffer));
 	if (bufp == NULL)
 		return NULL;
 
+	if (size >= HUGEPAGE_SIZE) {
+		maplen = (size + HUGEPAGE_SIZE-1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+		data = hugemap(maplen);
+		if (data != NULL) {
+			bufp->len = size;
+			bufp->data = data;
+			bufp->maplen = maplen;
+			bufp->used = 0;
+			return bufp;
+		}
+	}
+
+	rc = posix_memalign(&data, BUFFER_ALIGN, size > 0 ? size : 1);
+	if (rc != 0) {
+		free(bufp);
+		errno = rc;
+		return NULL;
+	}
+
 	bufp->len = size;
+	bufp->data = data;
+	bufp->maplen = 0;
+	bufp->used = 0;
 	return bufp;
 }
 
@@ -21,6 +95,12 @@ buffer_burnfree(struct buffer **bufp)
 {
 	if (*bufp == NULL)
 		return;
-	burn((*bufp)->data, (*bufp)->len);
+	/* only what was written to can hold secrets */
+	burn((*bufp)->data, (*bufp)->used);
+
+	if ((*bufp)->maplen > 0)
+		munmap((*bufp)->data, (*bufp)->maplen);
+	else
+		free((*bufp)->data);
 	free(*bufp);
 }
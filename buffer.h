@@ -6,9 +6,21 @@
 
 #include "cleanup.h"
 
+/*
+ * alignment of buffer data, enough for direct i/o and vector loads
+ */
+#define BUFFER_ALIGN	4096
+
+/*
+ * buffers of at least this size get huge pages
+ */
+#define HUGEPAGE_SIZE	(2*1024*1024)
+
 struct buffer {
-	size_t	len;
-	uint8_t	data[];
+	size_t	 len;
+	uint8_t	*data;
+	size_t	 maplen;	/* length of the mapping, 0 if malloc'ed */
+	size_t	 used;		/* high-water mark, burned on free */
 };
 
 #define cu_freebuffer	do_cleanup(buffer_burnfree)
@@ -17,5 +29,15 @@ struct buffer {
 struct buffer	*buffer_alloc(size_t size);
 void		 buffer_burnfree(struct buffer **bufp);
 
+/*
+ * buffer_touch - note that the first len bytes may hold data now
+ */
+static inline void
+buffer_touch(struct buffer *bufp, size_t len)
+{
+	if (len > bufp->used)
+		bufp->used = len;
+}
+
 
 #endif
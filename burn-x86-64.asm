@@ -1,17 +1,42 @@
-
 ; Input:
 ;	RDI	buffer to burn
 ;	RSI	buffer length
 ;
+; small buffers are zeroed with rep stosb, which is fast for any length
+; and alignment on recent cpus. big ones are written around the cache with
+; non temporal stores, so burning them does not evict our working set.
+;
+NTSIZE	equ	256*1024
+
 	global	burn
 burn:
+	xor	eax, eax
 	mov	rcx, rsi
-	shr	rcx, 3
-	xor	rax, rax
-	rep	stosq
+	cmp	rsi, NTSIZE
+	jb	.tail
 
-	mov	rcx, rsi
+	; align to 8 bytes
+	mov	rcx, rdi
+	neg	rcx
 	and	rcx, 7
+	sub	rsi, rcx
+	rep	stosb
+
+	mov	rcx, rsi
+	shr	rcx, 5
+	and	rsi, 31
+.nt:
+	movnti	[rdi], rax
+	movnti	[rdi+8], rax
+	movnti	[rdi+16], rax
+	movnti	[rdi+24], rax
+	add	rdi, 32
+	dec	rcx
+	jnz	.nt
+	sfence
+
+	mov	rcx, rsi
+.tail:
 	rep	stosb
 
 	ret
@@ -1,16 +1,33 @@
+#include <sys/mman.h>
+
 #include <stdint.h>
 
 #include "burn.h"
 #include "burnstack.h"
 
 /*
- * burnstack - cleanup our stack
+ * burnstack - cleanup len bytes of our stack, below the caller
  */
-void
-burnstack(int kb)
+NOINLINE void
+burnstack(int len)
 {
-	uint8_t stack[1024];
-	burn(stack, 1024);
-	if (kb > 0)
-		burnstack(kb-1024);
+	uint8_t stack[len];
+
+	burn(stack, len);
+}
+
+/*
+ * lockstack - lock the next kb kilobytes of our stack into memory
+ *
+ * the pages are touched first, so they exist. they stay locked after we
+ * return and hold the stack frames of the functions called next.
+ */
+int
+lockstack(int kb)
+{
+	uint8_t stack[kb*1024];
+
+	burn(stack, sizeof(stack));
+
+	return mlock(stack, sizeof(stack));
 }
@@ -2,5 +2,6 @@
 #define BURNSTACK_H
 
 void burnstack(int len);
+int lockstack(int kb);
 
 #endif
@@ -0,0 +1,38 @@
+# compile into an static binary
+#
+STATIC=no
+
+# specify the name of the target processor for which GCC should tune the
+# performance (see gcc manpage for options)
+#
+MTUNE=generic
+
+# if you have a linux system with getrandom() system call, set to yes
+#
+HAVE_GETRANDOM=no
+
+# use /dev/random instead of /dev/urandom
+#
+USE_DEV_RANDOM=no
+
+# enable x86_64 assembly code (only slightly faster than C at the moment)
+#
+USE_ASM_X86_64=no
+
+# link x86_64 AVX assembly to speed up serpent counter mode
+#
+# NOTE: this is only available for 64bit modes (like elf64). the code
+# is only used if the cpu supports AVX, so the binary still runs on
+# older cpus.
+#
+USE_ASM_AVX=no
+
+# link x86_64 AVX2 code to process 16 blocks at once in serpent counter
+# mode and 4 blocks at once in poly1305, used only if the cpu supports AVX2
+#
+USE_ASM_AVX2=no
+
+# if you have linux 5.1 or newer, set to yes to support asynchronous
+# i/o with io_uring (option --uring)
+#
+USE_IO_URING=no
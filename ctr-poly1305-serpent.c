@@ -0,0 +1,281 @@
+/*
+ * ctr-poly1305-serpent - counter mode and poly1305-serpent in one pass
+ *
+ * the data is processed tile by tile, so poly1305 reads the data while it
+ * is still in the cache instead of streaming the whole chunk through
+ * memory twice. the result is the same as ctr_serpent_crypt followed by
+ * poly1305_serpent_authdata (or the other way around for decryption).
+ *
+ * large amounts of data can be split into segments for several threads.
+ * the keystream of a segment starts at its position, its mac is computed
+ * from state 0 and joined with poly1305_append afterwards. the result is
+ * the same as with one thread.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utils.h"
+#include "burn.h"
+#include "burnstack.h"
+#include "secmem.h"
+#include "ctr-poly1305-serpent.h"
+
+
+/* stack burned by the segment threads */
+#define SEGMENT_STACK	(8*1024)
+
+
+struct segment {
+	struct ctr_serpent	 ctr;
+	struct poly1305_serpent	 poly;
+
+	uint8_t			*dst;
+	const uint8_t		*src;
+	size_t			 len;
+	int			 mode;
+
+	pthread_t		 thread;
+	int			 started;
+	int			 done;
+};
+
+
+static void
+tiles(struct ctr_serpent *ctr, struct poly1305_serpent *poly,
+      uint8_t *dst, const uint8_t *src, size_t len, int mode)
+{
+	size_t n;
+
+	for (; len > 0; len -= n, dst += n, src += n) {
+		n = MIN(len, CTR_POLY1305_TILE);
+
+		switch (mode) {
+		case CTR_POLY1305_ENCRYPT:
+			ctr_serpent_crypt(ctr, dst, src, n);
+			poly1305_serpent_update(poly, dst, n);
+			break;
+
+		case CTR_POLY1305_DECRYPT:
+			poly1305_serpent_update(poly, src, n);
+			ctr_serpent_crypt(ctr, dst, src, n);
+			break;
+
+		case CTR_POLY1305_MAC:
+			poly1305_serpent_update(poly, src, n);
+			break;
+
+		case CTR_POLY1305_CRYPT:
+			ctr_serpent_crypt(ctr, dst, src, n);
+			break;
+		}
+	}
+}
+
+static void *
+segment_main(void *arg)
+{
+	struct segment *s = (struct segment *)arg;
+
+	/* key material goes on our stack, without a lock split does it */
+	if (lockstack(SEGMENT_STACK / 1024) == -1)
+		return NULL;
+
+	tiles(&s->ctr, &s->poly, s->dst, s->src, s->len, s->mode);
+	s->done = 1;
+	burnstack(SEGMENT_STACK);
+
+	return NULL;
+}
+
+
+/*
+ * split - process len bytes in nseg segments, the first one in this thread
+ *
+ * returns -1 if there is no locked memory for the segment states, nothing
+ * is processed then.
+ */
+static int
+split(struct ctr_serpent *ctr, struct poly1305_serpent *poly,
+      uint8_t *dst, const uint8_t *src, size_t len, int mode, int nseg)
+{
+	const uint8_t zero[16] = { 0 };
+	struct segment *seg;
+	uint64_t pos = 0;
+	size_t seglen, off;
+	int i;
+
+	seg = secmem_alloc(nseg * sizeof(struct segment));
+	if (seg == NULL)
+		return -1;
+
+	if (ctr != NULL)
+		pos = ctr_serpent_tell(ctr);
+
+	/*
+	 * whole tiles, so only the last segment ends with a partial block.
+	 * rounded up, so nseg segments cover all of len.
+	 */
+	seglen = ((len + nseg-1) / nseg + CTR_POLY1305_TILE-1)
+		/ CTR_POLY1305_TILE * CTR_POLY1305_TILE;
+
+	for (i = 1, off = seglen; i < nseg && off < len; i++, off += seglen) {
+		if (ctr != NULL) {
+			seg[i].ctr = *ctr;
+			ctr_serpent_seek(&seg[i].ctr, pos + off);
+		}
+		if (poly != NULL) {
+			seg[i].poly = *poly;
+			poly1305_init(&seg[i].poly.poly1305, zero);
+		}
+
+		seg[i].dst = dst + off;
+		seg[i].src = src + off;
+		seg[i].len = MIN(seglen, len - off);
+		seg[i].mode = mode;
+		seg[i].done = 0;
+
+		/* without a thread it is done below */
+		seg[i].started = (pthread_create(&seg[i].thread, NULL,
+				segment_main, &seg[i]) == 0);
+	}
+	nseg = i;
+
+	tiles(ctr, poly, dst, src, MIN(seglen, len), mode);
+
+	for (i = 1; i < nseg; i++) {
+		if (seg[i].started)
+			pthread_join(seg[i].thread, NULL);
+		if (!seg[i].done)
+			tiles(&seg[i].ctr, &seg[i].poly, seg[i].dst,
+			      seg[i].src, seg[i].len, mode);
+
+		if (poly != NULL)
+			poly1305_append(&poly->poly1305,
+					&seg[i].poly.poly1305, seg[i].len / 16);
+	}
+
+	if (ctr != NULL)
+		ctr_serpent_seek(ctr, pos + len);
+
+	secmem_free(seg);
+
+	return 0;
+}
+
+
+/*
+ * ctr_poly1305_serpent_update - process the next len bytes of a message
+ *
+ * mode says what is done, see ctr-poly1305-serpent.h. ctr or poly may be
+ * NULL, if mode does not need it. the work is split between up to
+ * nthreads threads, if there is enough of it.
+ */
+void
+ctr_poly1305_serpent_update(struct ctr_serpent *ctr,
+			    struct poly1305_serpent *poly,
+			    uint8_t *dst, const uint8_t *src, size_t len,
+			    int mode, int nthreads)
+{
+	size_t n, nseg;
+
+	nseg = len / CTR_POLY1305_SEGMENT;
+	if (nseg > (size_t)nthreads)
+		nseg = nthreads;
+
+	if (nseg > 1 && poly != NULL && poly->poly1305.fill > 0) {
+		/* segments have to start at a block boundary of the mac */
+		n = 16 - poly->poly1305.fill;
+		tiles(ctr, poly, dst, src, n, mode);
+
+		dst += n;
+		src += n;
+		len -= n;
+	}
+
+	if (nseg > 1 && split(ctr, poly, dst, src, len, mode, nseg) == 0)
+		return;
+
+	tiles(ctr, poly, dst, src, len, mode);
+}
+
+
+/*
+ * ctr_poly1305_serpent_encrypt - encrypt src to dst and authenticate dst
+ */
+void
+ctr_poly1305_serpent_encrypt(struct ctr_serpent *ctr,
+			     struct poly1305_serpent *poly,
+			     const uint8_t nonce[16],
+			     uint8_t *dst, const uint8_t *src,
+			     size_t len, uint8_t mac[16], int nthreads)
+{
+	poly1305_serpent_start(poly, nonce);
+	ctr_poly1305_serpent_update(ctr, poly, dst, src, len,
+			CTR_POLY1305_ENCRYPT, nthreads);
+	poly1305_serpent_final(poly, mac);
+}
+
+
+/*
+ * ctr_poly1305_serpent_decrypt - authenticate src and decrypt it to dst
+ *
+ * returns 0 if mac is valid. otherwise -1 is returned and dst is zeroed,
+ * so unauthenticated plaintext never leaves this function.
+ */
+int
+ctr_poly1305_serpent_decrypt(struct ctr_serpent *ctr,
+			     struct poly1305_serpent *poly,
+			     const uint8_t nonce[16],
+			     uint8_t *dst, const uint8_t *src,
+			     size_t len, const uint8_t mac[16], int nthreads)
+{
+	uint8_t check[16];
+
+	poly1305_serpent_start(poly, nonce);
+	ctr_poly1305_serpent_update(ctr, poly, dst, src, len,
+			CTR_POLY1305_DECRYPT, nthreads);
+	poly1305_serpent_final(poly, check);
+
+	if (!ctiseq(mac, check, 16)) {
+		burn(dst, len);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * ctr_poly1305_serpent_open - check the mac of src, then decrypt to dst
+ *
+ * unlike ctr_poly1305_serpent_decrypt nothing is written to dst, if the
+ * mac is not valid (-1 is returned then). so dst may be visible to others,
+ * e.g. a shared mapping of the output file.
+ *
+ * both passes are split between the threads, so running them side by
+ * side would not save any work.
+ */
+int
+ctr_poly1305_serpent_open(struct ctr_serpent *ctr,
+			  struct poly1305_serpent *poly,
+			  const uint8_t nonce[16],
+			  uint8_t *dst, const uint8_t *src, size_t len,
+			  const uint8_t mac[16], int nthreads)
+{
+	uint8_t check[16];
+
+	poly1305_serpent_start(poly, nonce);
+	ctr_poly1305_serpent_update(NULL, poly, NULL, src, len,
+			CTR_POLY1305_MAC, nthreads);
+	poly1305_serpent_final(poly, check);
+
+	if (!ctiseq(mac, check, 16))
+		return -1;
+
+	ctr_poly1305_serpent_update(ctr, NULL, dst, src, len,
+			CTR_POLY1305_CRYPT, nthreads);
+
+	return 0;
+}
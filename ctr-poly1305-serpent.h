@@ -0,0 +1,55 @@
+#ifndef CTR_POLY1305_SERPENT_H
+#define CTR_POLY1305_SERPENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ctr-serpent.h"
+#include "poly1305-serpent.h"
+
+/*
+ * bytes processed by counter mode and poly1305 in one go, should fit
+ * into the l1 cache.
+ */
+#define CTR_POLY1305_TILE	(16*1024)
+
+/*
+ * smallest amount of data given to another thread
+ */
+#define CTR_POLY1305_SEGMENT	(256*1024)
+
+/*
+ * modes of ctr_poly1305_serpent_update
+ */
+#define CTR_POLY1305_ENCRYPT	0	/* encrypt, mac the result */
+#define CTR_POLY1305_DECRYPT	1	/* mac, then decrypt */
+#define CTR_POLY1305_MAC	2	/* only mac */
+#define CTR_POLY1305_CRYPT	3	/* only counter mode */
+
+
+void	ctr_poly1305_serpent_update(struct ctr_serpent *ctr,
+				    struct poly1305_serpent *poly,
+				    uint8_t *dst, const uint8_t *src,
+				    size_t len, int mode, int nthreads);
+
+void	ctr_poly1305_serpent_encrypt(struct ctr_serpent *ctr,
+				     struct poly1305_serpent *poly,
+				     const uint8_t nonce[16],
+				     uint8_t *dst, const uint8_t *src,
+				     size_t len, uint8_t mac[16],
+				     int nthreads);
+
+int	ctr_poly1305_serpent_decrypt(struct ctr_serpent *ctr,
+				     struct poly1305_serpent *poly,
+				     const uint8_t nonce[16],
+				     uint8_t *dst, const uint8_t *src,
+				     size_t len, const uint8_t mac[16],
+				     int nthreads);
+
+int	ctr_poly1305_serpent_open(struct ctr_serpent *ctr,
+				  struct poly1305_serpent *poly,
+				  const uint8_t nonce[16],
+				  uint8_t *dst, const uint8_t *src, size_t len,
+				  const uint8_t mac[16], int nthreads);
+
+#endif
@@ -2,9 +2,12 @@
  * ctr-serpent - this module implements counter mode for serpent block cipher
  */
 
+#include <stdint.h>
 #include <string.h>
 
+#include "utils.h"
 #include "serpent.h"
+#include "backend.h"
 #include "ctr-serpent.h"
 
 
@@ -22,6 +25,42 @@ ctr_serpent_nonce(struct ctr_serpent *ctx, const uint8_t nonce[8])
 	ctx->ctrused = 0;
 }
 
+/*
+ * ctr_serpent_seek - set keystream position to byte pos
+ *
+ * the nonce set with ctr_serpent_nonce is kept, only the block counter
+ * is changed. this allows to process chunks independently of each other.
+ */
+void
+ctr_serpent_seek(struct ctr_serpent *ctx, uint64_t pos)
+{
+	int i;
+
+	store_be64(ctx->ctr+8, pos / 16);
+	ctx->ctrused = pos % 16;
+
+	/* prepare carry-over if we start in the middle of a block */
+	if (ctx->ctrused > 0) {
+		serpent_encrypt(ctx->ctrenc, ctx->ctr, ctx->expkey);
+		for (i = 15; i >= 0 && ++ctx->ctr[i] == 0; i--);
+	}
+}
+
+/*
+ * ctr_serpent_tell - get keystream position, as set by ctr_serpent_seek
+ */
+uint64_t
+ctr_serpent_tell(const struct ctr_serpent *ctx)
+{
+	uint64_t block = load_be64(ctx->ctr+8);
+
+	/* with carry-over the counter is one block ahead */
+	if (ctx->ctrused > 0)
+		return (block - 1) * 16 + ctx->ctrused;
+
+	return block * 16;
+}
+
 
 /*
  * ctr_serpent_crypt - counter-mode for serpent
@@ -49,13 +88,15 @@ ctr_serpent_crypt(struct ctr_serpent *ctx, uint8_t *dst,
 	 */
 
 
-#ifdef USE_ASM_AVX
 	/*
-	 * loop over 8*16 byte chunks with optimized assembler routine
+	 * loop over multiple blocks with the routine of our backend
 	 */
-	for (; len >= 8*16; len -= 8*16, dst += 8*16, src += 8*16)
-		serpent8x_ctr(dst, src, ctx->expkey, ctx->ctr);
-#endif
+	if (backend->ctr != NULL) {
+		size_t step = 16 * backend->ctr_blocks;
+
+		for (; len >= step; len -= step, dst += step, src += step)
+			backend->ctr(dst, src, ctx->expkey, ctx->ctr);
+	}
 
 	/*
 	 * now loop over remaining 16 byte chunks with regular C code
@@ -16,6 +16,8 @@ struct ctr_serpent {
 
 void	 ctr_serpent_init(struct ctr_serpent *ctx, const uint8_t key[32]);
 void	 ctr_serpent_nonce(struct ctr_serpent *ctx, const uint8_t nonce[8]);
+void	 ctr_serpent_seek(struct ctr_serpent *ctx, uint64_t pos);
+uint64_t ctr_serpent_tell(const struct ctr_serpent *ctx);
 void	 ctr_serpent_crypt(struct ctr_serpent *ctx, uint8_t *dst,
 		  const uint8_t *src, size_t len);
 
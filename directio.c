@@ -0,0 +1,225 @@
+/*
+ * directio - file i/o with O_DIRECT, bypassing the page cache
+ *
+ * O_DIRECT needs file offsets, lengths and memory aligned to the block
+ * size of the device, but sfet chunks start at arbitrary offsets. so a
+ * read covers the surrounding aligned blocks and the data ends up in
+ * memory with the same alignment it has in the file. writes are done in
+ * whole blocks, the last partial block is carried over to the next write
+ * and written without O_DIRECT at the very end.
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "burn.h"
+#include "directio.h"
+
+
+static int
+setflag(int fd, int on)
+{
+#ifdef O_DIRECT
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		return -1;
+
+	flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	return fcntl(fd, F_SETFL, flags);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+int
+direct_enable(int fd)
+{
+	return setflag(fd, 1);
+}
+
+int
+direct_disable(int fd)
+{
+	return setflag(fd, 0);
+}
+
+
+/*
+ * direct_pread - read len bytes at file offset off
+ *
+ * area must be aligned and hold DIRECT_AREA(len) bytes. *data is set to
+ * the byte at off, which is off % DIRECT_ALIGN bytes into area. returns
+ * the number of bytes at *data, less than len only at the end of file,
+ * or -1 on error.
+ */
+ssize_t
+direct_pread(int fd, uint8_t *area, size_t len, uint64_t off, uint8_t **data)
+{
+	size_t slack = off % DIRECT_ALIGN;
+	size_t want = (slack + len + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+	uint64_t start = off - slack;
+	struct stat st;
+	size_t got = 0;
+	ssize_t n;
+
+	*data = area + slack;
+
+	while (got < want) {
+		n = pread(fd, area + got, want - got, start + got);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+
+		got += n;
+
+		if (got % DIRECT_ALIGN == 0)
+			continue;
+
+		/*
+		 * a partial block, O_DIRECT can't read on from there. it is
+		 * the end of file or the read was cut short, then the block
+		 * is read again from its start.
+		 */
+		if (fstat(fd, &st) == -1)
+			return -1;
+		if (start + got >= (uint64_t)st.st_size)
+			break;
+
+		got -= got % DIRECT_ALIGN;
+	}
+
+	if (got <= slack)
+		return 0;
+
+	return got - slack < len ? got - slack : len;
+}
+
+
+/*
+ * direct_out_init - start writing at file offset pos
+ *
+ * head holds the pos % DIRECT_ALIGN bytes in front of pos, which are
+ * written again with the first block. it may be NULL if pos is aligned.
+ */
+int
+direct_out_init(struct direct_out *d, int fd, uint64_t pos,
+		const uint8_t *head)
+{
+	void *p;
+	int rc;
+
+	rc = posix_memalign(&p, DIRECT_ALIGN, DIRECT_ALIGN);
+	if (rc != 0) {
+		d->carry = NULL;
+		errno = rc;
+		return -1;
+	}
+
+	d->fd = fd;
+	d->pos = pos;
+	d->carry = p;
+	if (head != NULL)
+		memcpy(d->carry, head, pos % DIRECT_ALIGN);
+
+	return 0;
+}
+
+
+/*
+ * direct_out_write - append len bytes from data
+ *
+ * data must have the same alignment as the file position, and the
+ * pos % DIRECT_ALIGN bytes in front of data must be writable: the carry
+ * from the last write is copied there, so only whole blocks are written.
+ */
+int
+direct_out_write(struct direct_out *d, uint8_t *data, size_t len)
+{
+	size_t slack = d->pos % DIRECT_ALIGN;
+	size_t full = (slack + len) / DIRECT_ALIGN * DIRECT_ALIGN;
+	uint8_t *start = data - slack;
+	uint64_t off = d->pos - slack;
+	size_t done = 0;
+	ssize_t n;
+
+	memcpy(start, d->carry, slack);
+
+	while (done < full) {
+		n = pwrite(d->fd, start + done, full - done, off + done);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+
+	/* keep the new partial block */
+	memcpy(d->carry, start + full, slack + len - full);
+	d->pos += len;
+
+	return 0;
+}
+
+
+/*
+ * direct_out_finish - write out the last partial block
+ */
+int
+direct_out_finish(struct direct_out *d)
+{
+	size_t slack = d->pos % DIRECT_ALIGN;
+	size_t done = 0;
+	ssize_t n;
+
+	if (slack == 0)
+		return 0;
+
+	/* the length is not aligned, so this has to go through the cache */
+	if (direct_disable(d->fd) == -1)
+		return -1;
+
+	while (done < slack) {
+		n = pwrite(d->fd, d->carry + done, slack - done,
+			   d->pos - slack + done);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+
+void
+direct_out_free(struct direct_out *d)
+{
+	if (d->carry == NULL)
+		return;
+
+	burn(d->carry, DIRECT_ALIGN);
+	free(d->carry);
+	d->carry = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef DIRECTIO_H
+#define DIRECTIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * alignment of file offsets, lengths and memory for O_DIRECT
+ */
+#define DIRECT_ALIGN	4096
+
+/* size of an area that can hold len bytes at any alignment */
+#define DIRECT_AREA(len)	(((len) + 2*DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN)
+
+
+/*
+ * sequential writer, keeps the last partial block until it is complete
+ */
+struct direct_out {
+	int		 fd;
+	uint64_t	 pos;		/* file offset of the next byte */
+	uint8_t		*carry;		/* partial block before pos */
+};
+
+int	direct_enable(int fd);
+int	direct_disable(int fd);
+
+ssize_t	direct_pread(int fd, uint8_t *area, size_t len, uint64_t off,
+		     uint8_t **data);
+
+int	direct_out_init(struct direct_out *d, int fd, uint64_t pos,
+			const uint8_t *head);
+int	direct_out_write(struct direct_out *d, uint8_t *data, size_t len);
+int	direct_out_finish(struct direct_out *d);
+void	direct_out_free(struct direct_out *d);
+
+#endif
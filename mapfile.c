@@ -0,0 +1,99 @@
+/*
+ * mapfile - map windows of regular files into memory
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "mapfile.h"
+
+
+/*
+ * mapfile - map len bytes of fd starting at off
+ *
+ * off does not need to be page aligned. a window of length 0 is not
+ * mapped at all, m->data is NULL then. returns 0 on success and -1 on
+ * error with errno set.
+ */
+int
+mapfile(struct mapping *m, int fd, uint64_t off, size_t len, int writable)
+{
+	uint64_t start;
+	long pagesize;
+	void *p;
+
+	m->base = NULL;
+	m->len = 0;
+	m->data = NULL;
+
+	if (len == 0)
+		return 0;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		pagesize = 4096;
+
+	start = off - off % pagesize;
+
+	p = mmap(NULL, len + (off - start),
+		 writable ? PROT_READ|PROT_WRITE : PROT_READ,
+		 MAP_SHARED, fd, start);
+	if (p == MAP_FAILED)
+		return -1;
+
+	m->base = p;
+	m->len = len + (off - start);
+	m->data = (uint8_t *)p + (off - start);
+
+	/* every byte is touched exactly once from front to back */
+	madvise(m->base, m->len, MADV_SEQUENTIAL);
+	if (!writable)
+		madvise(m->base, m->len, MADV_WILLNEED);
+
+	return 0;
+}
+
+
+void
+unmapfile(struct mapping *m)
+{
+	if (m->base == NULL)
+		return;
+
+	munmap(m->base, m->len);
+
+	m->base = NULL;
+	m->len = 0;
+	m->data = NULL;
+}
+
+
+/*
+ * preallocate - reserve disk space for a file of len bytes
+ *
+ * writing to a mapping can't report a full disk, so the space has to
+ * be there before. returns -1 if the file system can't do that.
+ */
+int
+preallocate(int fd, uint64_t len)
+{
+#ifdef __linux
+	if (len == 0)
+		return ftruncate(fd, 0);
+
+	return fallocate(fd, 0, 0, len);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
@@ -0,0 +1,22 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * a window of a file mapped into memory
+ */
+struct mapping {
+	void	*base;		/* page aligned start, NULL if not mapped */
+	size_t	 len;		/* length of the whole mapping */
+	uint8_t	*data;		/* points to the requested file offset */
+};
+
+int	mapfile(struct mapping *m, int fd, uint64_t off, size_t len,
+		int writable);
+void	unmapfile(struct mapping *m);
+
+int	preallocate(int fd, uint64_t len);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * pagecache - keep bulk streams out of the page cache
+ *
+ * the data we read is never needed again, so its pages are dropped
+ * behind us. for the output we start writeback of every new window
+ * right away and wait for the window before, then drop it. so there are
+ * never more than two windows of dirty pages and writeback does not pile
+ * up until it stalls us (and everybody else on the machine).
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pagecache.h"
+
+
+static uint64_t
+page_start(uint64_t pos)
+{
+	uint64_t pagesize = sysconf(_SC_PAGESIZE);
+
+	return pos - pos % pagesize;
+}
+
+
+/*
+ * cache_init - manage the cache of fd from file offset pos on
+ *
+ * if fd is -1 or no regular file, the other functions do nothing.
+ */
+void
+cache_init(struct cache *c, int fd, uint64_t pos)
+{
+	struct stat st;
+
+	c->fd = -1;
+	c->pos = pos;
+	c->done = c->pending = page_start(pos);
+
+	if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+
+	c->fd = fd;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+
+/*
+ * cache_read - the next len bytes were read and are not needed again
+ */
+void
+cache_read(struct cache *c, size_t len)
+{
+	c->pos += len;
+
+	if (c->fd == -1 || c->pos - c->done < CACHE_WINDOW)
+		return;
+
+	posix_fadvise(c->fd, c->done, c->pos - c->done, POSIX_FADV_DONTNEED);
+
+	/* the partial last page is dropped next time */
+	c->done = page_start(c->pos);
+}
+
+
+/*
+ * cache_write - the next len bytes were written
+ */
+void
+cache_write(struct cache *c, size_t len)
+{
+	c->pos += len;
+
+	if (c->fd == -1 || c->pos - c->pending < CACHE_WINDOW)
+		return;
+
+#ifdef __linux
+	/* start writeback of the new window */
+	sync_file_range(c->fd, c->pending, c->pos - c->pending,
+			SYNC_FILE_RANGE_WRITE);
+
+	/* and wait for the window before, only clean pages can be dropped */
+	if (c->pending > c->done) {
+		sync_file_range(c->fd, c->done, c->pending - c->done,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+				| SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(c->fd, c->done, c->pending - c->done,
+				POSIX_FADV_DONTNEED);
+	}
+#endif
+
+	c->done = page_start(c->pending);
+	c->pending = c->pos;
+}
@@ -0,0 +1,26 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * bytes handled at once, smaller steps are collected
+ */
+#define CACHE_WINDOW	(8*1024*1024)
+
+/*
+ * page cache state of a sequentially read or written file
+ */
+struct cache {
+	int		 fd;		/* -1 if not used */
+	uint64_t	 pos;		/* bytes read or written up to here */
+	uint64_t	 done;		/* pages before are dropped */
+	uint64_t	 pending;	/* writeback started up to here */
+};
+
+void	cache_init(struct cache *c, int fd, uint64_t pos);
+void	cache_read(struct cache *c, size_t len);
+void	cache_write(struct cache *c, size_t len);
+
+#endif
@@ -31,8 +31,18 @@
 #define OPAD	0x5c
 
 
-void
-hmac_sha512_init(sha512ctx *ctx, const uint8_t key[BS])
+/*
+ * keyed hmac context: the hash states after the inner and the outer key
+ * block, so every hmac computation starts from there.
+ */
+typedef struct {
+	sha512ctx	inner;
+	sha512ctx	outer;
+} hmac_sha512ctx;
+
+
+static void
+hmac_sha512_setkey(hmac_sha512ctx *ctx, const uint8_t key[BS])
 {
 	uint8_t pad[BS];
 	int i;
@@ -41,29 +51,29 @@ hmac_sha512_init(sha512ctx *ctx, const uint8_t key[BS])
 	for (i = 0; i < BS; i++)
 		pad[i] = key[i] ^ IPAD;
 
-	sha512_init(ctx);
-	sha512_update(ctx, pad, BS);
+	sha512_init(&ctx->inner);
+	sha512_update(&ctx->inner, pad, BS);
+
+	/* apply outer padding */
+	for (i = 0; i < BS; i++)
+		pad[i] = key[i] ^ OPAD;
+
+	sha512_init(&ctx->outer);
+	sha512_update(&ctx->outer, pad, BS);
 }
 
 
-void
-hmac_sha512_done(sha512ctx *ctx, const uint8_t key[BS], uint8_t result[HLEN])
+/*
+ * hmac_sha512_64 - hmac of a 64 byte message, costs two compressions
+ */
+static void
+hmac_sha512_64(const hmac_sha512ctx *ctx, const uint8_t msg[HLEN],
+	       uint8_t result[HLEN])
 {
-	uint8_t pad[BS];
 	uint8_t ihash[HLEN];
-	int i;
-
-	/* construct outer padding */
-	for (i = 0; i < BS; i++)
-		pad[i] = key[i] ^ OPAD;
-
-	/* finalize inner hash */
-	sha512_done(ctx, ihash);
 
-	sha512_init(ctx);
-	sha512_update(ctx, pad, BS);
-	sha512_update(ctx, ihash, HLEN);
-	sha512_done(ctx, result);
+	sha512_final64(&ctx->inner, msg, ihash);
+	sha512_final64(&ctx->outer, ihash, result);
 }
 
 
@@ -73,7 +83,8 @@ pbkdf2_hmac_sha512(uint8_t *out, size_t outlen,
 		   const uint8_t *salt, size_t saltlen,
 		   uint64_t iter)
 {
-	sha512ctx hmac, hmac_template;
+	hmac_sha512ctx hmac;
+	sha512ctx hash;
 	uint32_t i, be32i;
 	uint64_t j;
 	int k;
@@ -89,27 +100,27 @@ pbkdf2_hmac_sha512(uint8_t *out, size_t outlen,
 		memcpy(key, passwd, passlen);
 		memset(key + passlen, 0, BS-passlen);
 	} else {
-		sha512_init(&hmac);
-		sha512_update(&hmac, passwd, passlen);
-		sha512_done(&hmac, key);
+		sha512_init(&hash);
+		sha512_update(&hash, passwd, passlen);
+		sha512_done(&hash, key);
 		memset(key + HLEN, 0, BS-HLEN);
 	}
 
-	hmac_sha512_init(&hmac_template, key);
-	sha512_update(&hmac_template, salt, saltlen);
+	hmac_sha512_setkey(&hmac, key);
 
 	for (i = 1; outlen > 0; i++) {
-		memcpy(&hmac, &hmac_template, sizeof(sha512ctx));
+		/* first round: hmac of salt || be32(i) */
+		memcpy(&hash, &hmac.inner, sizeof(sha512ctx));
+		sha512_update(&hash, salt, saltlen);
 
 		be32i = htobe32(i);
-		sha512_update(&hmac, &be32i, sizeof(be32i));
-		hmac_sha512_done(&hmac, key, U);
+		sha512_update(&hash, &be32i, sizeof(be32i));
+		sha512_done(&hash, U);
+		sha512_final64(&hmac.outer, U, U);
 		memcpy(F, U, HLEN);
 
 		for (j = 2; j <= iter; j++) {
-			hmac_sha512_init(&hmac, key);
-			sha512_update(&hmac, U, HLEN);
-			hmac_sha512_done(&hmac, key, U);
+			hmac_sha512_64(&hmac, U, U);
 
 			for (k = 0; k < HLEN; k++)
 				F[k] ^= U[k];
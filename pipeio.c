@@ -0,0 +1,64 @@
+/*
+ * pipeio - larger pipes
+ *
+ * the output is copied into the pipe with write. handing our pages over
+ * with vmsplice is not safe: a reader that splices them on keeps
+ * references after they left the pipe, while we reuse and burn them.
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "pipeio.h"
+
+
+
+/*
+ * pipe_grow - make the pipe fd hold at least len bytes, if we may
+ *
+ * smaller sizes are tried if len is over the limit of the system. returns
+ * the new size of the pipe or -1 if fd is no pipe.
+ */
+int
+pipe_grow(int fd, size_t len)
+{
+#ifdef F_SETPIPE_SZ
+	struct stat st;
+	int size;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	if (!S_ISFIFO(st.st_mode)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = fcntl(fd, F_GETPIPE_SZ);
+	if (size == -1)
+		return -1;
+
+	if (len > INT_MAX / 2)
+		len = INT_MAX / 2;
+
+	for (; len > size; len /= 2) {
+		if (fcntl(fd, F_SETPIPE_SZ, (int)len) != -1)
+			return fcntl(fd, F_GETPIPE_SZ);
+	}
+
+	return size;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
@@ -0,0 +1,8 @@
+#ifndef PIPEIO_H
+#define PIPEIO_H
+
+#include <stddef.h>
+
+int	pipe_grow(int fd, size_t len);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * poly1305-append - join the poly1305 states of consecutive message parts
+ *
+ * poly1305 evaluates the message blocks m1..mn as a polynomial in r:
+ *
+ *	h = m1*r^n + m2*r^(n-1) + ... + mn*r
+ *
+ * so a message can be cut at a block boundary, both parts are evaluated
+ * independently (the second one starting with state 0) and joined with
+ *
+ *	h = h1 * r^n2 + h2
+ *
+ * where n2 is the number of blocks in the second part. this lets several
+ * threads work on one message.
+ *
+ * the state is left normalized, so it can be used by every backend.
+ */
+
+#include <stdint.h>
+
+#include "poly1305.h"
+
+
+#ifdef __LP64__
+
+#define M44	0xfffffffffff
+#define M42	0x3ffffffffff
+
+static void
+normalize(elem_t x)
+{
+	x[1] += x[0] >> 44;
+	x[0] &= M44;
+	x[2] += x[1] >> 44;
+	x[1] &= M44;
+	x[0] += 5 * (x[2] >> 42);
+	x[2] &= M42;
+	x[1] += x[0] >> 44;
+	x[0] &= M44;
+}
+
+/*
+ * mul - out = a * b, the limbs of a and b must be normalized
+ */
+static void
+mul(elem_t out, const elem_t a, const elem_t b)
+{
+	llimb_t t[3];
+	limb_t sb1 = 20*b[1], sb2 = 20*b[2];
+
+	t[0] = (llimb_t)a[0]*b[0] + (llimb_t)a[1]*sb2 + (llimb_t)a[2]*sb1;
+	t[1] = (llimb_t)a[0]*b[1] + (llimb_t)a[1]*b[0] + (llimb_t)a[2]*sb2;
+	t[2] = (llimb_t)a[0]*b[2] + (llimb_t)a[1]*b[1] + (llimb_t)a[2]*b[0];
+
+	t[1] += t[0] >> 44;
+	t[2] += t[1] >> 44;
+
+	out[0] = (t[0] & M44) + 20*(t[2] >> 44);
+	out[1] = t[1] & M44;
+	out[2] = t[2] & M44;
+
+	normalize(out);
+}
+
+#else
+
+#define M26	0x3ffffff
+
+static void
+normalize(elem_t x)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		x[i+1] += x[i] >> 26;
+		x[i] &= M26;
+	}
+	x[0] += 5 * (x[4] >> 26);
+	x[4] &= M26;
+	x[1] += x[0] >> 26;
+	x[0] &= M26;
+}
+
+static void
+mul(elem_t out, const elem_t a, const elem_t b)
+{
+	llimb_t t[5], carry;
+	int i, j;
+
+	for (i = 0; i < 5; i++) {
+		t[i] = 0;
+		for (j = 0; j <= i; j++)
+			t[i] += (llimb_t)a[j] * b[i-j];
+		for (j = i+1; j < 5; j++)
+			t[i] += (llimb_t)a[j] * 5*b[i+5-j];
+	}
+
+	for (i = 0; i < 4; i++) {
+		t[i+1] += t[i] >> 26;
+		t[i] &= M26;
+	}
+	carry = t[4] >> 26;
+	t[4] &= M26;
+	t[0] += 5 * carry;
+
+	for (i = 0; i < 5; i++)
+		out[i] = t[i];
+
+	normalize(out);
+}
+
+#endif
+
+
+/*
+ * poly1305_append - append the message part of seg to ctx
+ *
+ * ctx must end at a block boundary (no partial block buffered), seg was
+ * started with poly1305_init and has seen nblocks full blocks. a partial
+ * block at the end of seg is taken over, so more data can follow.
+ */
+void
+poly1305_append(struct poly1305 *ctx, const struct poly1305 *seg,
+		uint64_t nblocks)
+{
+	elem_t h, p, x;
+	int i;
+
+	for (i = 0; i < LIMB_NUM; i++) {
+		h[i] = ctx->state[i];
+		p[i] = ctx->r[i];
+		x[i] = (i == 0);
+	}
+	normalize(h);
+	normalize(p);
+
+	/* x = r^nblocks */
+	for (; nblocks > 0; nblocks >>= 1) {
+		if (nblocks & 1)
+			mul(x, x, p);
+		mul(p, p, p);
+	}
+
+	mul(h, h, x);
+
+	for (i = 0; i < LIMB_NUM; i++)
+		h[i] += seg->state[i];
+	normalize(h);
+
+	for (i = 0; i < LIMB_NUM; i++)
+		ctx->state[i] = h[i];
+
+	for (i = 0; i < seg->fill; i++)
+		ctx->buffer[i] = seg->buffer[i];
+	ctx->fill = seg->fill;
+}
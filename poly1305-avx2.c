@@ -0,0 +1,281 @@
+/*
+ * poly1305-avx2 - four-way parallel poly1305 with avx2
+ *
+ * the message blocks are split into four interleaved streams, every
+ * stream is evaluated with r^4 in one 64 bit lane of the ymm registers
+ * (radix 2^26). at the end the lanes are multiplied with r^4, r^3, r^2
+ * and r and summed up, which gives the same result as the serial horner
+ * scheme:
+ *
+ *	h' = (h + m1)*r^4 + m2*r^3 + m3*r^2 + m4*r
+ *
+ * the powers of r are computed once in poly1305_setkey_avx2. the state is
+ * converted from and to the 44 bit limbs of the 64 bit code, so the short
+ * and unaligned parts are done by the scalar poly1305_update (C or asm).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "poly1305.h"
+
+
+#define M26	0x3ffffffULL
+#define M44	0xfffffffffffULL
+
+/* use the vector code only for at least this many bytes */
+#define AVX2_MIN	(16*16)
+
+
+/*
+ * to26 - convert 44 bit limbs to 26 bit limbs
+ */
+static void
+to26(uint64_t out[5], const limb_t in[3])
+{
+	uint64_t s0 = in[0], s1 = in[1], s2 = in[2];
+
+	/* normalize, so the limbs don't overlap */
+	s1 += s0 >> 44;
+	s0 &= M44;
+	s2 += s1 >> 44;
+	s1 &= M44;
+	s0 += 5*(s2 >> 42);
+	s2 &= 0x3ffffffffffULL;
+	s1 += s0 >> 44;
+	s0 &= M44;
+	s2 += s1 >> 44;
+	s1 &= M44;
+
+	out[0] = s0 & M26;
+	out[1] = (s0 >> 26) | ((s1 << 18) & M26);
+	out[2] = (s1 >> 8) & M26;
+	out[3] = (s1 >> 34) | ((s2 << 10) & M26);
+	out[4] = s2 >> 16;
+}
+
+/*
+ * to44 - convert 26 bit limbs (carried) back to 44 bit limbs
+ */
+static void
+to44(limb_t out[3], const uint64_t in[5])
+{
+	uint64_t t;
+
+	t = in[0] + (in[1] << 26);
+	out[0] = t & M44;
+
+	t = (t >> 44) + (in[2] << 8) + (in[3] << 34);
+	out[1] = t & M44;
+
+	out[2] = (t >> 44) + (in[4] << 16);
+}
+
+static void
+carry26(uint64_t d[5])
+{
+	d[1] += d[0] >> 26;	d[0] &= M26;
+	d[2] += d[1] >> 26;	d[1] &= M26;
+	d[3] += d[2] >> 26;	d[2] &= M26;
+	d[4] += d[3] >> 26;	d[3] &= M26;
+	d[0] += 5*(d[4] >> 26);	d[4] &= M26;
+	d[1] += d[0] >> 26;	d[0] &= M26;
+}
+
+/*
+ * mul26 - scalar multiplication modulo 2^130-5, used for the powers of r
+ */
+static void
+mul26(uint32_t out[5], const uint32_t a[5], const uint32_t b[5])
+{
+	uint64_t d[5];
+	uint64_t s1 = 5*(uint64_t)b[1], s2 = 5*(uint64_t)b[2];
+	uint64_t s3 = 5*(uint64_t)b[3], s4 = 5*(uint64_t)b[4];
+	int i;
+
+	d[0] = (uint64_t)a[0]*b[0] + a[1]*s4 + a[2]*s3 + a[3]*s2 + a[4]*s1;
+	d[1] = (uint64_t)a[0]*b[1] + (uint64_t)a[1]*b[0] + a[2]*s4 + a[3]*s3 + a[4]*s2;
+	d[2] = (uint64_t)a[0]*b[2] + (uint64_t)a[1]*b[1] + (uint64_t)a[2]*b[0] + a[3]*s4 + a[4]*s3;
+	d[3] = (uint64_t)a[0]*b[3] + (uint64_t)a[1]*b[2] + (uint64_t)a[2]*b[1] + (uint64_t)a[3]*b[0] + a[4]*s4;
+	d[4] = (uint64_t)a[0]*b[4] + (uint64_t)a[1]*b[3] + (uint64_t)a[2]*b[2] + (uint64_t)a[3]*b[1] + (uint64_t)a[4]*b[0];
+
+	carry26(d);
+
+	for (i = 0; i < 5; i++)
+		out[i] = d[i];
+}
+
+
+
+#define MUL(a, b)	_mm256_mul_epu32((a), (b))
+#define ADD(a, b)	_mm256_add_epi64((a), (b))
+
+/*
+ * mulmod - a <- a*r in every lane, s holds 5*r
+ */
+static inline void
+mulmod(__m256i a[5], const __m256i r[5], const __m256i s[5])
+{
+	const __m256i mask = _mm256_set1_epi64x(M26);
+	__m256i d0, d1, d2, d3, d4, c;
+
+	d0 = ADD(ADD(ADD(ADD(MUL(a[0], r[0]), MUL(a[1], s[4])),
+		MUL(a[2], s[3])), MUL(a[3], s[2])), MUL(a[4], s[1]));
+	d1 = ADD(ADD(ADD(ADD(MUL(a[0], r[1]), MUL(a[1], r[0])),
+		MUL(a[2], s[4])), MUL(a[3], s[3])), MUL(a[4], s[2]));
+	d2 = ADD(ADD(ADD(ADD(MUL(a[0], r[2]), MUL(a[1], r[1])),
+		MUL(a[2], r[0])), MUL(a[3], s[4])), MUL(a[4], s[3]));
+	d3 = ADD(ADD(ADD(ADD(MUL(a[0], r[3]), MUL(a[1], r[2])),
+		MUL(a[2], r[1])), MUL(a[3], r[0])), MUL(a[4], s[4]));
+	d4 = ADD(ADD(ADD(ADD(MUL(a[0], r[4]), MUL(a[1], r[3])),
+		MUL(a[2], r[2])), MUL(a[3], r[1])), MUL(a[4], r[0]));
+
+	/* carry */
+	c = _mm256_srli_epi64(d0, 26);	d0 = _mm256_and_si256(d0, mask);
+	d1 = ADD(d1, c);
+	c = _mm256_srli_epi64(d1, 26);	d1 = _mm256_and_si256(d1, mask);
+	d2 = ADD(d2, c);
+	c = _mm256_srli_epi64(d2, 26);	d2 = _mm256_and_si256(d2, mask);
+	d3 = ADD(d3, c);
+	c = _mm256_srli_epi64(d3, 26);	d3 = _mm256_and_si256(d3, mask);
+	d4 = ADD(d4, c);
+	c = _mm256_srli_epi64(d4, 26);	d4 = _mm256_and_si256(d4, mask);
+	d0 = ADD(d0, ADD(c, _mm256_slli_epi64(c, 2)));
+	c = _mm256_srli_epi64(d0, 26);	d0 = _mm256_and_si256(d0, mask);
+	d1 = ADD(d1, c);
+
+	a[0] = d0;
+	a[1] = d1;
+	a[2] = d2;
+	a[3] = d3;
+	a[4] = d4;
+}
+
+/*
+ * load4 - split four message blocks into 26 bit limbs
+ *
+ * the lanes hold the blocks in the order 0, 2, 1, 3.
+ */
+static inline void
+load4(__m256i m[5], const uint8_t *data)
+{
+	const __m256i mask = _mm256_set1_epi64x(M26);
+	const __m256i hibit = _mm256_set1_epi64x(1 << 24);
+	__m256i x, y, lo, hi;
+
+	x = _mm256_loadu_si256((const __m256i *)data);
+	y = _mm256_loadu_si256((const __m256i *)(data + 32));
+
+	lo = _mm256_unpacklo_epi64(x, y);
+	hi = _mm256_unpackhi_epi64(x, y);
+
+	m[0] = _mm256_and_si256(lo, mask);
+	m[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+	m[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52),
+				_mm256_slli_epi64(hi, 12)), mask);
+	m[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+	m[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), hibit);
+}
+
+/*
+ * blocks4 - process nblocks full blocks, nblocks is a multiple of 4
+ */
+static void
+blocks4(struct poly1305 *ctx, const uint8_t *data, size_t nblocks)
+{
+	uint32_t (*rp)[5] = ctx->rpow;
+	__m256i a[5], m[5], r[5], s[5];
+	uint64_t h[5], lane[4];
+	int i, k;
+
+	/* r^4 in every lane */
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm256_set1_epi64x(rp[3][i]);
+		s[i] = _mm256_set1_epi64x(5*(uint64_t)rp[3][i]);
+	}
+
+	/* start with the state in the first stream */
+	to26(h, ctx->state);
+	load4(a, data);
+	for (i = 0; i < 5; i++)
+		a[i] = ADD(a[i], _mm256_set_epi64x(0, 0, 0, h[i]));
+
+	for (data += 64, nblocks -= 4; nblocks > 0; data += 64, nblocks -= 4) {
+		mulmod(a, r, s);
+		load4(m, data);
+		for (i = 0; i < 5; i++)
+			a[i] = ADD(a[i], m[i]);
+	}
+
+	/* multiply stream 0, 2, 1, 3 with r^4, r^2, r^3, r */
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm256_set_epi64x(rp[0][i], rp[2][i], rp[1][i], rp[3][i]);
+		s[i] = _mm256_set_epi64x(5*(uint64_t)rp[0][i], 5*(uint64_t)rp[2][i],
+				5*(uint64_t)rp[1][i], 5*(uint64_t)rp[3][i]);
+	}
+	mulmod(a, r, s);
+
+	/* sum up the lanes */
+	for (i = 0; i < 5; i++) {
+		_mm256_storeu_si256((__m256i *)lane, a[i]);
+		for (h[i] = 0, k = 0; k < 4; k++)
+			h[i] += lane[k];
+	}
+
+	carry26(h);
+	to44(ctx->state, h);
+}
+
+
+
+/*
+ * exported functions
+ */
+
+void
+poly1305_setkey_avx2(struct poly1305 *ctx, const uint8_t r[16])
+{
+	uint64_t r26[5];
+	int i;
+
+	poly1305_setkey(ctx, r);
+
+	/* rpow[k] = r^(k+1) */
+	to26(r26, ctx->r);
+	for (i = 0; i < 5; i++)
+		ctx->rpow[0][i] = r26[i];
+
+	mul26(ctx->rpow[1], ctx->rpow[0], ctx->rpow[0]);
+	mul26(ctx->rpow[2], ctx->rpow[1], ctx->rpow[0]);
+	mul26(ctx->rpow[3], ctx->rpow[1], ctx->rpow[1]);
+}
+
+
+void
+poly1305_update_avx2(struct poly1305 *ctx, const uint8_t *data, size_t len)
+{
+	size_t n;
+
+	/* complete a partial block with the scalar code */
+	if (ctx->fill > 0) {
+		n = 16 - ctx->fill;
+		if (len < n)
+			n = len;
+
+		poly1305_update(ctx, data, n);
+		data += n;
+		len -= n;
+	}
+
+	if (len >= AVX2_MIN) {
+		n = (len / 64) * 64;
+
+		blocks4(ctx, data, n / 16);
+		data += n;
+		len -= n;
+	}
+
+	/* rest */
+	poly1305_update(ctx, data, len);
+}
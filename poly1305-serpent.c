@@ -1,8 +1,14 @@
+/*
+ * poly1305-serpent - poly1305 with a serpent encrypted nonce as one-time key
+ */
+
 #include <stdint.h>
 #include <string.h>
 
+#include "utils.h"
 #include "poly1305.h"
 #include "serpent.h"
+#include "backend.h"
 #include "poly1305-serpent.h"
 
 void
@@ -12,25 +18,113 @@ poly1305_serpent_setkey(struct poly1305_serpent *ctx, const uint8_t kr[32])
 	serpent_setkey(ctx->expkey, kr, 16);
 
 	/* set poly1305 key */
-	poly1305_setkey(&ctx->poly1305, kr+16);
+	backend->poly1305_setkey(&ctx->poly1305, kr+16);
+
+	ctx->nkeys = 0;
+	ctx->batch = 1;
+}
+
+/*
+ * poly1305_serpent_batch - say if messages come with consecutive nonces
+ *
+ * only then the one-time keys are derived in batches. a worker that gets
+ * every n-th chunk would use just one key of each batch.
+ */
+void
+poly1305_serpent_batch(struct poly1305_serpent *ctx, int on)
+{
+	ctx->batch = on;
+	ctx->nkeys = 0;
+}
+
+
+/*
+ * derive_keys - one-time keys for nonce and the nonces following it
+ *
+ * the nonces of consecutive chunks count up like the counter of counter
+ * mode, so the wide counter mode routine of the backend encrypts a batch
+ * of them in one call. the next chunks find their key ready.
+ */
+static void
+derive_keys(struct poly1305_serpent *ctx, const uint8_t nonce[16])
+{
+	static const uint8_t zero[POLY1305_SERPENT_KEYS * 16];
+	uint8_t ctr[16];
+
+	memcpy(ctx->keynonce, nonce, 16);
+
+	if (!ctx->batch || backend->ctr == NULL
+	    || backend->ctr_blocks > POLY1305_SERPENT_KEYS) {
+		serpent_encrypt(ctx->keys[0], nonce, ctx->expkey);
+		ctx->nkeys = 1;
+		return;
+	}
+
+	memcpy(ctr, nonce, 16);
+	backend->ctr(ctx->keys[0], zero, ctx->expkey, ctr);
+	ctx->nkeys = backend->ctr_blocks;
+}
+
+/*
+ * key_index - position of the one-time key for nonce, -1 if not derived
+ */
+static int
+key_index(const struct poly1305_serpent *ctx, const uint8_t nonce[16])
+{
+	uint64_t d;
+
+	if (ctx->nkeys == 0 || memcmp(nonce, ctx->keynonce, 8) != 0)
+		return -1;
+
+	d = load_be64(nonce+8) - load_be64(ctx->keynonce+8);
+
+	return d < ctx->nkeys ? d : -1;
 }
 
 
+/*
+ * poly1305_serpent_start - start a mac for a new message with nonce
+ *
+ * the message can then be given to poly1305_serpent_update in pieces of
+ * any size, poly1305_serpent_final returns the mac.
+ */
 void
-poly1305_serpent_authdata(struct poly1305_serpent *ctx,
-			  const uint8_t *data, size_t len,
-			  const uint8_t nonce[16],
-			  uint8_t mac[16])
+poly1305_serpent_start(struct poly1305_serpent *ctx, const uint8_t nonce[16])
 {
-	uint8_t	s[16];
+	int i;
 
-	/* encrypt nonce for poly1305 */
-	serpent_encrypt(s, nonce, ctx->expkey);
+	/* encrypted nonce, usually derived with the ones before */
+	i = key_index(ctx, nonce);
+	if (i == -1) {
+		derive_keys(ctx, nonce);
+		i = 0;
+	}
 
 	/* reset poly1305 with encrypted nonce */
-	poly1305_init(&ctx->poly1305, s);
+	poly1305_init(&ctx->poly1305, ctx->keys[i]);
+}
+
+void
+poly1305_serpent_update(struct poly1305_serpent *ctx,
+			const uint8_t *data, size_t len)
+{
+	backend->poly1305_update(&ctx->poly1305, data, len);
+}
 
-	/* authorize data */
-	poly1305_update(&ctx->poly1305, data, len);
+void
+poly1305_serpent_final(struct poly1305_serpent *ctx, uint8_t mac[16])
+{
 	poly1305_mac(&ctx->poly1305, mac);
 }
+
+
+void
+poly1305_serpent_authdata(struct poly1305_serpent *ctx,
+			  const uint8_t *data, size_t len,
+			  const uint8_t nonce[16],
+			  uint8_t mac[16])
+{
+	poly1305_serpent_start(ctx, nonce);
+	poly1305_serpent_update(ctx, data, len);
+	poly1305_serpent_final(ctx, mac);
+}
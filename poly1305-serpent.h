@@ -6,15 +6,37 @@
 #include "poly1305.h"
 #include "serpent.h"
 
+/*
+ * one-time keys derived at once, the widest counter mode of the backends
+ */
+#define POLY1305_SERPENT_KEYS	16
+
 struct poly1305_serpent {
 	struct poly1305		poly1305;
 
 	uint32_t		expkey[SERPENT_EXPKEY_WORDS];
+
+	/* one-time keys for keynonce and the nonces following it */
+	uint8_t			keys[POLY1305_SERPENT_KEYS][16];
+	uint8_t			keynonce[16];
+	int			nkeys;
+	int			batch;		/* nonces come in order */
 };
 
 void	poly1305_serpent_setkey(struct poly1305_serpent *ctx,
 				const uint8_t kr[32]);
 
+void	poly1305_serpent_batch(struct poly1305_serpent *ctx, int on);
+
+void	poly1305_serpent_start(struct poly1305_serpent *ctx,
+			       const uint8_t nonce[16]);
+
+void	poly1305_serpent_update(struct poly1305_serpent *ctx,
+				const uint8_t *data, size_t len);
+
+void	poly1305_serpent_final(struct poly1305_serpent *ctx,
+			       uint8_t mac[16]);
+
 void	poly1305_serpent_authdata(struct poly1305_serpent *ctx,
 				  const uint8_t *data, size_t len,
 				  const uint8_t nonce[16],
@@ -5,7 +5,7 @@ alignmode p6
 
 ;
 ; WARNING: this structure MUST be kept in sync with 'struct poly1305'
-; in poly1305.h
+; in poly1305.h (rpow at the end is only used by the C code)
 ;
 struc	context
 	.state0		resq	1
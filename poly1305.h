@@ -41,6 +41,9 @@ struct poly1305 {
 
 	uint8_t		buffer[17];
 	uint8_t		fill;
+
+	/* r^1 to r^4 in 26 bit limbs, only used by the avx2 code */
+	uint32_t	rpow[4][5];
 };
 
 
@@ -50,5 +53,13 @@ void	poly1305_init(struct poly1305 *ctx, const uint8_t s[16]);
 void	poly1305_update(struct poly1305 *ctx, const uint8_t *data, size_t len);
 void	poly1305_mac(struct poly1305 *ctx, uint8_t mac[16]);
 
+void	poly1305_append(struct poly1305 *ctx, const struct poly1305 *seg,
+			uint64_t nblocks);
+
+#ifdef USE_ASM_AVX2
+void	poly1305_setkey_avx2(struct poly1305 *ctx, const uint8_t r[16]);
+void	poly1305_update_avx2(struct poly1305 *ctx, const uint8_t *data, size_t len);
+#endif
+
 
 #endif
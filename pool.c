@@ -0,0 +1,436 @@
+/*
+ * pool - process chunks in parallel with a fixed number of worker threads
+ *
+ * this is a three stage pipeline: a reader thread fills the chunk ring in
+ * order, the worker threads process the chunks and the calling thread
+ * writes them out in order. the ring has two slots more than we have
+ * workers, so the next chunk can be read and the previous one written
+ * while all workers are busy.
+ *
+ * with asynchronous i/o the reader and writer keep up to depth requests
+ * in flight, the ring grows by the same number of slots.
+ *
+ * a worker can take runs of consecutive chunks instead of single ones,
+ * then the ring has run slots per worker.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "burnstack.h"
+#include "buffer.h"
+#include "secmem.h"
+#include "mapfile.h"
+#include "pool.h"
+
+
+/* kilobytes of worker stack locked into memory */
+#define POOL_LOCKSTACK	8
+
+
+struct worker {
+	struct pool	*pool;
+	pthread_t	 thread;
+	void		*wctx;
+};
+
+struct pool {
+	const struct pool_ops	*ops;
+	void			*arg;
+
+	struct chunk		*ring;
+	int			 nslots;
+
+	struct worker		*workers;
+	int			 nworkers;	/* running threads */
+	int			 run;		/* chunks taken at once */
+
+	pthread_t		 reader;
+	int			 reader_running;
+
+	uint64_t		 nread;		/* chunks submitted */
+	uint64_t		 nstarted;	/* chunks taken by a worker */
+	uint64_t		 nwritten;	/* chunks written, slot is free */
+
+	int			 last;		/* last chunk was read */
+	int			 rerror;	/* reader failed */
+	int			 quit;
+	int			 lockwarned;
+
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work;		/* new chunk or quit */
+	pthread_cond_t		 done;		/* chunk processed or read */
+	pthread_cond_t		 space;		/* slot free or quit */
+};
+
+
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct pool *p = w->pool;
+	struct chunk *c;
+	uint64_t first, n, i;
+	int rc;
+
+	/* the crypto code keeps key material on our stack */
+	rc = lockstack(POOL_LOCKSTACK);
+
+	pthread_mutex_lock(&p->lock);
+	if (rc == -1 && !p->lockwarned) {
+		warn("can't lock stack of worker threads");
+		p->lockwarned = 1;
+	}
+
+	for (;;) {
+		/* a full run, or what is left when the reader has stopped */
+		while (!p->quit && p->nread - p->nstarted < (uint64_t)p->run
+		       && (p->nstarted == p->nread
+			   || !(p->last || p->rerror)))
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->quit)
+			break;
+
+		first = p->nstarted;
+		n = p->nread - first;
+		if (n > (uint64_t)p->run)
+			n = p->run;
+		p->nstarted += n;
+
+		for (i = 0; i < n; i++) {
+			c = &p->ring[(first + i) % p->nslots];
+			pthread_mutex_unlock(&p->lock);
+
+			c->rval = p->ops->process(w->wctx, c);
+			if (c->rval == 0 && p->ops->store)
+				c->serror = (p->ops->store(p->arg, c) == -1);
+
+			pthread_mutex_lock(&p->lock);
+			c->done = 1;
+			pthread_cond_broadcast(&p->done);
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	burnstack(POOL_LOCKSTACK * 1024);
+
+	return NULL;
+}
+
+
+static void *
+reader_main(void *arg)
+{
+	struct pool *p = (struct pool *)arg;
+	const struct pool_ops *ops = p->ops;
+	struct chunk *c;
+	uint64_t nsub, nwaited;
+	int depth = ops->read_wait ? ops->depth : 1;
+	int last = 0;
+	int rc;
+
+	pthread_mutex_lock(&p->lock);
+
+	/* chunks nwaited up to nsub are in flight */
+	nsub = nwaited = p->nread;
+
+	for (;;) {
+		/* start reading as many chunks as we can */
+		while (!p->quit && !last && nsub - nwaited < depth
+		       && nsub - p->nwritten < p->nslots) {
+			c = &p->ring[nsub % p->nslots];
+			c->index = nsub;
+			pthread_mutex_unlock(&p->lock);
+
+			rc = ops->read(p->arg, c);
+
+			pthread_mutex_lock(&p->lock);
+			if (rc == -1)
+				goto fail;
+			nsub++;
+			last = (rc == 1);
+		}
+		if (p->quit)
+			break;
+
+		if (nsub == nwaited) {
+			pthread_cond_wait(&p->space, &p->lock);
+			continue;
+		}
+
+		/* wait for the oldest chunk */
+		c = &p->ring[nwaited % p->nslots];
+		if (ops->read_wait) {
+			pthread_mutex_unlock(&p->lock);
+			rc = ops->read_wait(p->arg, c);
+			pthread_mutex_lock(&p->lock);
+		} else
+			rc = 0;
+		nwaited++;
+		if (rc == -1)
+			goto fail;
+
+		/* submit chunk to the workers */
+		c->done = 0;
+		c->serror = 0;
+		p->nread++;
+		pthread_cond_signal(&p->work);
+
+		if (last && nwaited == nsub) {
+			p->last = 1;
+			pthread_cond_broadcast(&p->work);
+			pthread_cond_broadcast(&p->done);
+			break;
+		}
+	}
+	goto out;
+
+fail:
+	p->rerror = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_cond_broadcast(&p->done);
+
+out:
+	/* the buffers must not be freed while the kernel still uses them */
+	for (; ops->read_wait && nwaited < nsub; nwaited++) {
+		pthread_mutex_unlock(&p->lock);
+		ops->read_wait(p->arg, &p->ring[nwaited % p->nslots]);
+		pthread_mutex_lock(&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+
+/*
+ * next_done - get chunk number n as soon as it is processed
+ *
+ * returns 1 and sets *cp if the chunk is ready, 0 if it is not ready and
+ * block is not set and -1 if there are no more chunks.
+ */
+static int
+next_done(struct pool *p, uint64_t n, int block, struct chunk **cp)
+{
+	int rval;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		if (n < p->nread) {
+			*cp = &p->ring[n % p->nslots];
+			if ((*cp)->done) {
+				rval = 1;
+				break;
+			}
+		} else if (p->last || p->rerror) {
+			rval = -1;
+			break;
+		}
+
+		if (!block) {
+			rval = 0;
+			break;
+		}
+		pthread_cond_wait(&p->done, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return rval;
+}
+
+static void
+release(struct pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->nwritten++;
+	pthread_cond_signal(&p->space);
+	pthread_mutex_unlock(&p->lock);
+}
+
+
+static void
+stop_threads(struct pool *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_cond_broadcast(&p->space);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->reader_running)
+		pthread_join(p->reader, NULL);
+	p->reader_running = 0;
+
+	for (i = 0; i < p->nworkers; i++)
+		pthread_join(p->workers[i].thread, NULL);
+	p->nworkers = 0;
+}
+
+static int
+start_threads(struct pool *p, int nthreads)
+{
+	int i, rc;
+
+	for (i = 0; i < nthreads; i++) {
+		p->workers[i].pool = p;
+
+		rc = pthread_create(&p->workers[i].thread, NULL,
+				worker_main, &p->workers[i]);
+		if (rc != 0)
+			goto fail;
+		p->nworkers++;
+	}
+
+	rc = pthread_create(&p->reader, NULL, reader_main, p);
+	if (rc != 0)
+		goto fail;
+	p->reader_running = 1;
+
+	return 0;
+
+fail:
+	warnx("can't create thread: %s", strerror(rc));
+	stop_threads(p);
+	return -1;
+}
+
+
+
+/*
+ * pool_run - read, process and write all chunks
+ *
+ * every worker gets its own copy of wctx (wctxlen bytes) in locked memory,
+ * which is burned afterwards. a worker takes run consecutive chunks at a
+ * time, fewer only at the end. every chunk has a buffer with buflen bytes,
+ * or none if buflen is 0 and the callbacks work on mapped files. mappings
+ * left in the ring are unmapped at the end.
+ */
+int
+pool_run(const struct pool_ops *ops, void *arg,
+	 const void *wctx, size_t wctxlen,
+	 int nthreads, int run, size_t buflen)
+{
+	struct pool pool;
+	struct chunk *c;
+	uint64_t nsub = 0;	/* chunks given to write */
+	int async = (ops->write_wait != NULL);
+	int rval = -1;
+	int i, rc;
+
+
+	memset(&pool, 0, sizeof(struct pool));
+	pool.ops = ops;
+	pool.arg = arg;
+	pool.run = run;
+	pool.nslots = nthreads * run + 2;
+	if (ops->read_wait)
+		pool.nslots += ops->depth - 1;
+	if (ops->write_wait)
+		pool.nslots += ops->depth - 1;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pthread_cond_init(&pool.space, NULL);
+
+	/* allocate chunk ring and worker contexts */
+	pool.ring = calloc(pool.nslots, sizeof(struct chunk));
+	pool.workers = calloc(nthreads, sizeof(struct worker));
+	if (pool.ring == NULL || pool.workers == NULL) {
+		warn("can't allocate memory");
+		goto out;
+	}
+
+	for (i = 0; i < pool.nslots; i++) {
+		pool.ring[i].slot = i;
+		if (buflen == 0)
+			continue;
+
+		pool.ring[i].buffer = buffer_alloc(buflen);
+		if (pool.ring[i].buffer == NULL) {
+			warn("can't allocate memory");
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pool.workers[i].wctx = secmem_alloc(wctxlen);
+		if (pool.workers[i].wctx == NULL) {
+			warn("can't allocate locked memory");
+			goto out;
+		}
+		memcpy(pool.workers[i].wctx, wctx, wctxlen);
+	}
+
+	if (ops->setup && ops->setup(arg, pool.ring, pool.nslots) == -1)
+		goto out;
+
+	if (start_threads(&pool, nthreads) == -1)
+		goto out;
+
+	/*
+	 * write out chunks in order. with asynchronous writes we only block
+	 * for the next chunk if no write is in flight, otherwise we wait for
+	 * the oldest write to free its slot.
+	 */
+	for (;;) {
+		rc = next_done(&pool, nsub, nsub == pool.nwritten, &c);
+		if (rc == 1) {
+			if (c->serror || ops->write(arg, c) == -1)
+				goto out;
+			nsub++;
+
+			if (!async) {
+				release(&pool);
+				continue;
+			}
+			if (nsub - pool.nwritten < ops->depth)
+				continue;
+		} else if (rc == -1 && nsub == pool.nwritten)
+			break;
+
+		c = &pool.ring[pool.nwritten % pool.nslots];
+		rc = ops->write_wait(arg, c);
+		release(&pool);
+		if (rc == -1)
+			goto out;
+	}
+
+	if (!pool.rerror)
+		rval = 0;
+
+out:
+	stop_threads(&pool);
+
+	/* wait for writes still in flight before freeing the buffers */
+	for (; pool.nwritten < nsub; pool.nwritten++)
+		ops->write_wait(arg, &pool.ring[pool.nwritten % pool.nslots]);
+
+	if (pool.workers) {
+		for (i = 0; i < nthreads; i++)
+			secmem_free(pool.workers[i].wctx);
+		free(pool.workers);
+	}
+
+	if (pool.ring) {
+		for (i = 0; i < pool.nslots; i++) {
+			buffer_burnfree(&pool.ring[i].buffer);
+			unmapfile(&pool.ring[i].in);
+			unmapfile(&pool.ring[i].out);
+		}
+		free(pool.ring);
+	}
+
+	pthread_cond_destroy(&pool.space);
+	pthread_cond_destroy(&pool.done);
+	pthread_cond_destroy(&pool.work);
+	pthread_mutex_destroy(&pool.lock);
+
+	return rval;
+}
@@ -0,0 +1,70 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "buffer.h"
+#include "mapfile.h"
+
+/*
+ * maximal number of worker threads
+ */
+#define POOL_MAXTHREADS	256
+
+
+struct chunk {
+	struct buffer	*buffer;	/* NULL if the pool has no buffers */
+	struct mapping	 in;		/* or mapped input and output */
+	struct mapping	 out;
+
+	uint8_t		*src;		/* data to process, set by read */
+	uint8_t		*dst;		/* result of process */
+
+	size_t		 len;		/* data length, without mac */
+	uint64_t	 index;		/* chunk number, starting with 0 */
+	int		 slot;		/* position in the ring */
+	size_t		 want;		/* bytes of pending i/o */
+	uint8_t		 nonce[16];	/* poly1305 nonce of this chunk */
+
+	int		 rval;		/* return value of process */
+	int		 serror;	/* set by the pool, store failed */
+	int		 done;		/* set by the pool, process has finished */
+};
+
+/*
+ * read: called in chunk order from the reader thread, returns 0 if more
+ *       chunks follow, 1 for the last chunk and -1 on error.
+ * process: called from the worker threads with a private copy of the
+ *       worker context, the return value is stored in chunk->rval.
+ * write: called in chunk order from the calling thread, returns 0 on
+ *       success and -1 on error.
+ * store: optional, called from the worker threads after process returned
+ *       0, in no particular order, e.g. to write the chunk to its place
+ *       in the output file. returns 0 or -1, the pool stops at a chunk
+ *       that could not be stored, write is not called for it.
+ *
+ * for asynchronous i/o read and write only submit the request, up to
+ * depth chunks are in flight on each side. read_wait and write_wait
+ * (called in chunk order from the same threads) wait until the i/o of
+ * that chunk is complete and return 0 or -1. setup is called with the
+ * ring before any other callback, e.g. to register the buffers.
+ */
+struct pool_ops {
+	int	(*read)(void *arg, struct chunk *c);
+	int	(*process)(void *wctx, struct chunk *c);
+	int	(*write)(void *arg, struct chunk *c);
+	int	(*store)(void *arg, struct chunk *c);
+
+	int	(*setup)(void *arg, struct chunk *ring, int nslots);
+	int	(*read_wait)(void *arg, struct chunk *c);
+	int	(*write_wait)(void *arg, struct chunk *c);
+	int	  depth;
+};
+
+
+int	pool_run(const struct pool_ops *ops, void *arg,
+		 const void *wctx, size_t wctxlen,
+		 int nthreads, int run, size_t buflen);
+
+#endif
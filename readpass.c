@@ -183,6 +183,9 @@ read_pass_fn(const char *fn, uint8_t *passwd, size_t max, const char *promptA, c
 			warn("can't open password source: %s", fn);
 			return -1;
 		}
+
+		/* no stdio buffer, it would hold a copy of the password */
+		setvbuf(passfile, NULL, _IONBF, 0);
 	}
 
 	rval = read_pass(passfile, passwd, max, promptA, promptB);
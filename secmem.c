@@ -0,0 +1,145 @@
+/*
+ * secmem - locked memory for passwords, keys and key schedules
+ *
+ * secrets come from a small arena, which is locked into memory and left
+ * out of core dumps. requests that don't fit get their own mapping with
+ * the same properties. the bulk data buffers are not allocated here, so
+ * they don't count against the memlock limit.
+ *
+ * the arena is used like a stack: freeing the topmost block or all of
+ * them makes the space available again. freed memory is burned.
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+#endif
+
+#include <sys/mman.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "burn.h"
+#include "secmem.h"
+
+
+/* blocks are aligned to a cache line */
+#define ALIGN	64
+
+struct block {
+	size_t	 len;		/* usable bytes after the header */
+	size_t	 maplen;	/* length of its own mapping, 0 in the arena */
+	uint8_t	 pad[ALIGN - 2*sizeof(size_t)];
+};
+
+static pthread_mutex_t	 lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t		*arena;
+static size_t		 used;
+static int		 nalloc;
+
+
+
+static void *
+lockedmap(size_t len)
+{
+	void *p;
+	int e;
+
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+			-1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	if (mlock(p, len) == -1) {
+		e = errno;
+		munmap(p, len);
+		errno = e;
+		return NULL;
+	}
+
+#ifdef MADV_DONTDUMP
+	madvise(p, len, MADV_DONTDUMP);
+#endif
+
+	return p;
+}
+
+
+/*
+ * secmem_alloc - get len bytes of zeroed, locked memory
+ *
+ * returns NULL with errno set, if the memory can't be locked.
+ */
+void *
+secmem_alloc(size_t len)
+{
+	struct block *b = NULL;
+	size_t need, pagesize;
+
+	need = sizeof(struct block) + (len + ALIGN-1) / ALIGN * ALIGN;
+
+	pthread_mutex_lock(&lock);
+	if (arena == NULL)
+		arena = lockedmap(SECMEM_ARENA);
+
+	if (arena != NULL && need <= SECMEM_ARENA - used) {
+		b = (struct block *)(arena + used);
+		b->len = need - sizeof(struct block);
+		b->maplen = 0;
+
+		used += need;
+		nalloc++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (b == NULL) {
+		pagesize = sysconf(_SC_PAGESIZE);
+		need = (need + pagesize-1) / pagesize * pagesize;
+
+		b = lockedmap(need);
+		if (b == NULL)
+			return NULL;
+
+		b->len = need - sizeof(struct block);
+		b->maplen = need;
+	}
+
+	/* fresh or burned, so it is zero already */
+	return b + 1;
+}
+
+
+/*
+ * secmem_free - burn and give back memory from secmem_alloc
+ */
+void
+secmem_free(void *ptr)
+{
+	struct block *b;
+
+	if (ptr == NULL)
+		return;
+
+	b = (struct block *)ptr - 1;
+	burn(ptr, b->len);
+
+	if (b->maplen > 0) {
+		munmap(b, b->maplen);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if ((uint8_t *)ptr + b->len == arena + used)
+		used = (uint8_t *)b - arena;
+	if (--nalloc == 0)
+		used = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+cleanup_secfree(void *ptr)
+{
+	secmem_free(*(void **)ptr);
+}
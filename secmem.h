@@ -0,0 +1,20 @@
+#ifndef SECMEM_H
+#define SECMEM_H
+
+#include <stddef.h>
+
+#include "cleanup.h"
+
+/*
+ * size of the locked arena for small secrets
+ */
+#define SECMEM_ARENA	(16*1024)
+
+#define cu_secfree	do_cleanup(cleanup_secfree)
+
+
+void	*secmem_alloc(size_t len);
+void	 secmem_free(void *ptr);
+void	 cleanup_secfree(void *ptr);
+
+#endif
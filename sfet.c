@@ -5,6 +5,8 @@
 
 #include <sys/resource.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -13,18 +15,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
 #include <limits.h>
 #include <endian.h>
 #include <err.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "cleanup.h"
 #include "buffer.h"
+#include "burn.h"
 #include "burnstack.h"
+#include "secmem.h"
 #include "readpass.h"
+#include "pool.h"
+#include "mapfile.h"
+#include "directio.h"
+#include "pipeio.h"
+#include "pagecache.h"
+#include "sparse.h"
+#include "uring.h"
+#include "backend.h"
 #include "pbkdf2-hmac-sha512.h"
 #include "poly1305-serpent.h"
 #include "ctr-serpent.h"
+#include "ctr-poly1305-serpent.h"
 
 
 
@@ -36,114 +52,1858 @@
 #define PASSLEN		512
 #define CHUNKLEN	(32*1024*1024)
 
+/* largest chunk length, a chunk and its mac fit into 32 bit lengths */
+#define MAX_CHUNKLEN	(1024*1024*1024)
+
+/* smallest chunk length for which we map files instead of reading them */
+#define MAP_MINCHUNK	(4*1024*1024)
+
+/* largest input that is handled on the stack, without pool and buffers */
+#define SMALL_MAXLEN	4096
+
+/* largest chunk length for which workers take runs of chunks */
+#define RUN_MAXCHUNK	(64*1024)
+
+/* window size of decrypt_bounded, used if chunks don't fit into memory */
+#define BOUNDED_WINDOW		(1024*1024)
+
 
 
 struct config {
 	int		 verbose;
 	int		 force;
+	int		 threads;
+	int		 testonly;	/* only check macs, no output */
+	int		 direct;	/* bypass the page cache */
+	int		 uring;		/* io_uring queue depth, 0 for none */
+	int		 keepcache;	/* no fadvise and write-behind */
+	int		 bounded;	/* always decrypt in windows */
 
 	uint64_t	 iterations;
 	uint64_t	 chunklen;
 	const char	*passfn;
+
+	uint64_t	 offset;	/* decrypt only this range */
+	uint64_t	 length;	/* 0 means up to the end */
+};
+
+struct header {
+	char	 magic[4];
+	uint16_t version;
+	uint64_t iter;
+	uint8_t	 nonce[16];
+	uint64_t chunklen;
+} __attribute__((packed));
+
+/* plaintext range to decrypt */
+struct range {
+	uint64_t	 first;		/* number of the first chunk read */
+	uint64_t	 offset;	/* first byte */
+	uint64_t	 end;		/* one past the last byte */
+};
+
+/* crypto state, every worker thread has its own copy */
+struct cryptctx {
+	struct ctr_serpent	 ctr;
+	struct poly1305_serpent	 poly;
+	uint64_t		 chunklen;
+	struct range		 range;
+	int			 split;		/* threads per chunk */
+};
+
+/* everything secret of a run, see secmem.c */
+struct secrets {
+	uint8_t			 passwd[PASSLEN];
+	uint8_t			 key[32+32];	/* 32 serpent ctr + 32 poly1305-serpent */
+	struct cryptctx		 ctx;
+};
+
+/* reading and writing side of encrypt and decrypt */
+struct job {
+	FILE		*in;
+	FILE		*out;
+	const char	*inputfn;
+	const char	*outputfn;
+
+	uint64_t	 chunklen;
+	uint8_t		 nonce[16];	/* nonce for the next chunk */
+	size_t		 readlen;	/* data bytes read per chunk, see size_job */
+	int		 threads;
+	int		 run;		/* chunks a worker takes at once */
+
+	struct range	 range;
+	uint64_t	 left;		/* chunks left to read, 0 for all */
+
+	/* mapped files and direct i/o */
+	uint64_t	 inbase;	/* file offset of the first chunk */
+	uint64_t	 outbase;
+	uint64_t	 insize;	/* input bytes from inbase on */
+	uint64_t	 nchunks;
+	uint64_t	 outsize;
+	uint64_t	 written;	/* output bytes done, from outbase on */
+	struct direct_out dout;
+	int		 sparse;	/* zero blocks become holes */
+
+	/* page cache of input and output, see pagecache.c */
+	struct cache	 incache;	/* used by the reader thread */
+	struct cache	 outcache;	/* used by the writer */
+
+#ifdef USE_IO_URING
+	struct aio	 rio;		/* used by the reader thread */
+	struct aio	 wio;		/* used by the writer */
+#endif
+};
+
+
+static void
+printhex(FILE *fp, const uint8_t *vec, size_t n)
+{
+	int i;
+
+        if (n > 0) {
+                for (i = 0; i < n; i++)
+                        fprintf(fp, "%02x", vec[i]);
+	} else
+                fputc('-', fp);
+
+        fputc('\n', fp);
+}
+
+
+static void
+printusage(FILE *fp)
+{
+	fprintf(fp, "decrypt:\tsfet [-d] [-vf] [-p <fn>] [-j <n>] [--direct] [--keep-cache] [--uring <n>] [--bounded] [--offset <n>] [--length <n>] [<input>] [<output>]\n");
+	fprintf(fp, "encrypt:\tsfet -e [-vf] [-p <fn>] [-i <iter>] [-c <length>] [-j <n>] [--direct] [--keep-cache] [--uring <n>] [<input>] [<output>]\n");
+	fprintf(fp, "test integrity:\tsfet -t [-v] [-p <fn>] [-j <n>] [--direct] [--keep-cache] [--uring <n>] [--bounded] [--offset <n>] [--length <n>] [<input>]\n");
+	fprintf(fp, "show metadata:\tsfet -s [-v] [<input>]\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "options:\n");
+	fprintf(fp, "  -v\t\tincrease verbosity level\n");
+	fprintf(fp, "  -f\t\toverwrite outputfile, if it already exists\n");
+	fprintf(fp, "  -p <file>\tread password from <file> instead of %s\n", PASSWD_SRC);
+	fprintf(fp, "  -i <n>\tset pbkdf2 iteration number to <n>, encryption only\n");
+	fprintf(fp, "  -c <length>\tset chunk size to <length>, encryption only\n");
+	fprintf(fp, "  -j <n>\t\tprocess <n> chunks in parallel\n");
+	fprintf(fp, "  --offset <n>\tdecrypt starting at plaintext byte <n>\n");
+	fprintf(fp, "  --length <n>\tdecrypt only <n> bytes\n");
+	fprintf(fp, "  --direct\tuse direct i/o, bypassing the page cache\n");
+	fprintf(fp, "  --keep-cache\tleave read and written data in the page cache\n");
+	fprintf(fp, "  --uring <n>\tuse io_uring with up to <n> reads and writes in flight\n");
+	fprintf(fp, "  --bounded\tdecrypt in small windows, reading every chunk twice\n");
+	fprintf(fp, "  -V\t\tshow version\n");
+	fprintf(fp, "  -h\t\tshow this help message\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "environment:\n");
+	fprintf(fp, "  SFET_BACKEND\tforce crypto backend: generic, avx or avx2\n");
+}
+
+static void
+printversion(FILE *fp)
+{
+	fprintf(fp, "sfet %s, file version: %d\n", VERSION, FILEVER);
+
+#if defined(USE_ASM_X86_64) || defined(USE_ASM_AVX) || defined(USE_ASM_AVX2)
+	fprintf(fp, "build with: ");
+
+#ifdef USE_ASM_X86_64
+	fprintf(fp, "ASM-X86-64 ");
+#endif
+#ifdef USE_ASM_AVX
+	fprintf(fp, "AVX ");
+#endif
+#ifdef USE_ASM_AVX2
+	fprintf(fp, "AVX2 ");
+#endif
+	fprintf(fp, "\n");
+#endif
+
+	fprintf(fp, "backend: %s\n", backend->name);
+}
+
+static int
+parse_size(uint64_t *out, const char *str)
+{
+	char *endp;
+	long long int n;
+
+	n = strtoll(str, &endp, 10);
+	if (n < 0 || n == LLONG_MAX || endp == str)
+		return -1;
+
+	switch (*endp) {
+	case '\0':
+		*out = n;
+		break;
+	case 'k': case 'K':
+		*out = (uint64_t)n * 1024;
+		break;
+	case 'm': case 'M':
+		*out = (uint64_t)n * 1024 * 1024;
+		break;
+	case 'g': case 'G':
+		*out = (uint64_t)n * 1024 * 1024 * 1024;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static inline void
+next_nonce(uint8_t nonce[16])
+{
+	int i;
+	for (i = 15; i >= 0 && ++nonce[i] == 0; i--);
+}
+
+static void
+add_nonce(uint8_t nonce[16], uint64_t n)
+{
+	unsigned int sum = 0;
+	int i;
+
+	for (i = 15; i >= 0; i--, n >>= 8) {
+		sum += nonce[i] + (n & 0xff);
+		nonce[i] = sum & 0xff;
+		sum >>= 8;
+	}
+}
+
+/*
+ * clip - part [lo, hi) of chunk number index inside the range
+ */
+static void
+clip(const struct range *r, uint64_t index, uint64_t chunklen, size_t len,
+     size_t *lo, size_t *hi)
+{
+	uint64_t pos = (r->first + index) * chunklen;
+
+	*lo = 0;
+	*hi = len;
+
+	if (r->offset > pos)
+		*lo = r->offset - pos < len ? r->offset - pos : len;
+	if (r->end < pos + len)
+		*hi = r->end > pos ? r->end - pos : 0;
+	if (*hi < *lo)
+		*hi = *lo;
+}
+
+
+
+/*
+ * check_chunk - check the mac of a chunk, returns 0 if it is valid
+ */
+static int
+check_chunk(struct cryptctx *ctx, const struct chunk *c)
+{
+	uint8_t check[16];
+
+	poly1305_serpent_start(&ctx->poly, c->nonce);
+	ctr_poly1305_serpent_update(NULL, &ctx->poly, NULL, c->src, c->len,
+			CTR_POLY1305_MAC, ctx->split);
+	poly1305_serpent_final(&ctx->poly, check);
+
+	return ctiseq(c->src + c->len, check, 16) ? 0 : -1;
+}
+
+
+
+/*
+ * chunk callbacks for pool_run
+ */
+
+static int
+encrypt_read(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	c->len = fread(c->buffer->data, 1, job->readlen, job->in);
+	buffer_touch(c->buffer, c->len+16);
+	if (c->len < job->readlen && ferror(job->in)) {
+		warn("%s: error reading file", job->inputfn);
+		return -1;
+	}
+	cache_read(&job->incache, c->len);
+
+	c->src = c->dst = c->buffer->data;
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->len < job->chunklen;
+}
+
+static int
+encrypt_process(void *wctx, struct chunk *c)
+{
+	struct cryptctx *ctx = (struct cryptctx *)wctx;
+
+	ctr_serpent_seek(&ctx->ctr, c->index * ctx->chunklen);
+	ctr_poly1305_serpent_encrypt(&ctx->ctr, &ctx->poly, c->nonce,
+			c->dst, c->src, c->len, c->dst + c->len, ctx->split);
+
+	return 0;
+}
+
+static int
+encrypt_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (fwrite(c->buffer->data, 1, c->len+16, job->out) != c->len+16) {
+		warn("%s: can't write to output file", job->outputfn);
+		return -1;
+	}
+	cache_write(&job->outcache, c->len+16);
+
+	return 0;
+}
+
+static const struct pool_ops encrypt_ops = {
+	.read = encrypt_read,
+	.process = encrypt_process,
+	.write = encrypt_write,
+};
+
+
+static int
+decrypt_read(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	size_t n;
+
+	n = fread(c->buffer->data, 1, job->readlen+16, job->in);
+	buffer_touch(c->buffer, n);
+	if (n < job->readlen+16 && ferror(job->in)) {
+		warn("%s: can't read from input file", job->inputfn);
+		return -1;
+	}
+	cache_read(&job->incache, n);
+	if (n < 16) {
+		warnx("%s: incomplete chunk, file is damaged", job->inputfn);
+		return -1;
+	}
+
+	/* set len to the data length in this chunk */
+	c->len = n - 16;
+	c->src = c->dst = c->buffer->data;
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	/* stop after the last chunk of a range */
+	if (job->left > 0 && --job->left == 0)
+		return 1;
+
+	return c->len < job->chunklen;
+}
+
+static int
+decrypt_process(void *wctx, struct chunk *c)
+{
+	struct cryptctx *ctx = (struct cryptctx *)wctx;
+	uint64_t pos = (ctx->range.first + c->index) * ctx->chunklen;
+	size_t lo, hi;
+
+	clip(&ctx->range, c->index, ctx->chunklen, c->len, &lo, &hi);
+
+	if (lo == 0 && hi == c->len) {
+		ctr_serpent_seek(&ctx->ctr, pos);
+		return ctr_poly1305_serpent_decrypt(&ctx->ctr, &ctx->poly,
+				c->nonce, c->dst, c->src, c->len, c->src + c->len,
+				ctx->split);
+	}
+
+	/* chunk is only partly needed: check all, decrypt only the range */
+	if (check_chunk(ctx, c) == -1)
+		return -1;
+
+	ctr_serpent_seek(&ctx->ctr, pos + lo);
+	ctr_poly1305_serpent_update(&ctx->ctr, NULL, c->dst + lo, c->src + lo,
+			hi-lo, CTR_POLY1305_CRYPT, ctx->split);
+
+	return 0;
+}
+
+/*
+ * fwrite_sparse - write data, but seek over all zero blocks
+ *
+ * only used behind the end of the output file, so the holes read as
+ * zeros. sparse_finish sets the size in case the file ends with a hole.
+ */
+static int
+fwrite_sparse(struct job *job, const uint8_t *data, size_t len)
+{
+	off_t off;
+	size_t n;
+	int zero;
+
+	off = ftello(job->out);
+	if (off == -1) {
+		warn("%s: can't get output file position", job->outputfn);
+		return -1;
+	}
+
+	for (; len > 0; data += n, len -= n, off += n) {
+		n = sparse_run(data, len, off, &zero);
+
+		if (zero) {
+			if (fseeko(job->out, n, SEEK_CUR) == -1) {
+				warn("%s: can't seek in output file",
+						job->outputfn);
+				return -1;
+			}
+		} else if (fwrite(data, 1, n, job->out) != n) {
+			warn("%s: can't write to output file", job->outputfn);
+			return -1;
+		}
+
+		cache_write(&job->outcache, n);
+	}
+
+	return 0;
+}
+
+static int
+pwrite_chunk(struct job *job, const uint8_t *data, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fileno(job->out), data, len, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			warn("%s: can't write to output file", job->outputfn);
+			return -1;
+		}
+
+		data += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+/*
+ * store_sparse - store data at off, all zero blocks become holes
+ *
+ * if the data is already in place in a mapping, only the holes are made.
+ */
+static int
+store_sparse(struct job *job, const uint8_t *data, size_t len, uint64_t off,
+	     int inplace)
+{
+	size_t n;
+	int zero;
+
+	for (; len > 0; data += n, len -= n, off += n) {
+		n = sparse_run(data, len, off, &zero);
+
+		if (zero && punch_hole(fileno(job->out), off, n) == 0)
+			continue;
+		if (!inplace && pwrite_chunk(job, data, n, off) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+decrypt_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	size_t lo, hi;
+
+	/* never write out unauthenticated data */
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	clip(&job->range, c->index, job->chunklen, c->len, &lo, &hi);
+
+	if (job->sparse)
+		return fwrite_sparse(job, c->dst + lo, hi-lo);
+
+	if (fwrite(c->dst + lo, 1, hi-lo, job->out) != hi-lo) {
+		warn("%s: can't write to output file", job->outputfn);
+		return -1;
+	}
+	cache_write(&job->outcache, hi-lo);
+
+	return 0;
+}
+
+static const struct pool_ops decrypt_ops = {
+	.read = decrypt_read,
+	.process = decrypt_process,
+	.write = decrypt_write,
 };
 
-struct header {
-	char	 magic[4];
-	uint16_t version;
-	uint64_t iter;
-	uint8_t	 nonce[16];
-	uint64_t chunklen;
-} __attribute__((packed));
+
+/*
+ * verify only checks the chunk macs, no keystream is generated
+ */
+static int
+verify_process(void *wctx, struct chunk *c)
+{
+	struct cryptctx *ctx = (struct cryptctx *)wctx;
+
+	return check_chunk(ctx, c);
+}
+
+static int
+verify_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct pool_ops verify_ops = {
+	.read = decrypt_read,
+	.process = verify_process,
+	.write = verify_write,
+};
+
+
+
+/*
+ * sparse_start - check if the output can get holes
+ *
+ * the output must be a regular file and we must be at its end, so the
+ * blocks we seek over read as zeros.
+ */
+static int
+sparse_start(struct job *job)
+{
+	struct stat st;
+	off_t pos;
+	int flags;
+
+	if (job->out == NULL || fflush(job->out) == EOF)
+		return 0;
+
+	if (fstat(fileno(job->out), &st) == -1 || !S_ISREG(st.st_mode))
+		return 0;
+
+	flags = fcntl(fileno(job->out), F_GETFL);
+	if (flags == -1 || (flags & O_APPEND))
+		return 0;
+
+	pos = ftello(job->out);
+
+	return pos != -1 && pos >= st.st_size;
+}
+
+/*
+ * sparse_finish - set the size of a file that ends with a hole
+ */
+static int
+sparse_finish(struct job *job)
+{
+	off_t pos;
+
+	if (fflush(job->out) == EOF || (pos = ftello(job->out)) == -1
+	    || ftruncate(fileno(job->out), pos) == -1) {
+		warn("%s: can't set size of output file", job->outputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * cache_start - set up the page cache handling for stdio and mapped files
+ */
+static void
+cache_start(struct job *job, const struct config *conf)
+{
+	off_t inpos = ftello(job->in);
+	off_t outpos = job->out ? ftello(job->out) : -1;
+
+	cache_init(&job->incache, conf->keepcache || inpos == -1
+			? -1 : fileno(job->in), inpos);
+	cache_init(&job->outcache, conf->keepcache || outpos == -1
+			? -1 : fileno(job->out), outpos);
+}
+
+
+/*
+ * pipe_start - grow the pipes we read from and write to
+ *
+ * so a chunk moves with one read or write instead of many small ones.
+ */
+static void
+pipe_start(struct job *job, size_t inlen, size_t outlen)
+{
+	pipe_grow(fileno(job->in), inlen);
+
+	if (job->out != NULL)
+		pipe_grow(fileno(job->out), 2*outlen);
+}
+
+
+
+/*
+ * chunk callbacks for mapped files
+ *
+ * the chunks are mapped by the reader thread, crypto runs from the input
+ * mapping directly into the preallocated output file.
+ */
+
+/*
+ * map_check - make sure the files still have the size they are mapped with
+ *
+ * touching a mapping behind the end of its file raises SIGBUS, so a file
+ * that shrank is reported before the next chunk is mapped. if it shrinks
+ * while a chunk is processed, map_sigbus gives up.
+ */
+static int
+map_check(struct job *job)
+{
+	struct stat st;
+
+	if (fstat(fileno(job->in), &st) == -1) {
+		warn("%s: can't stat input file", job->inputfn);
+		return -1;
+	}
+	if ((uint64_t)st.st_size < job->inbase + job->insize) {
+		warnx("%s: input file shrank while reading", job->inputfn);
+		return -1;
+	}
+
+	if (fstat(fileno(job->out), &st) == -1) {
+		warn("%s: can't stat output file", job->outputfn);
+		return -1;
+	}
+	if ((uint64_t)st.st_size < job->outsize) {
+		warnx("%s: output file shrank while writing", job->outputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+encrypt_map(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	uint64_t pos = c->index * job->chunklen;
+
+	if (map_check(job) == -1)
+		return -1;
+
+	c->len = MIN(job->chunklen, job->insize - pos);
+
+	if (mapfile(&c->in, fileno(job->in), job->inbase + pos,
+			c->len, 0) == -1) {
+		warn("%s: can't map input file", job->inputfn);
+		return -1;
+	}
+	if (mapfile(&c->out, fileno(job->out),
+			job->outbase + c->index * (job->chunklen+16),
+			c->len + 16, 1) == -1) {
+		warn("%s: can't map output file", job->outputfn);
+		return -1;
+	}
+
+	c->src = c->in.data;
+	c->dst = c->out.data;
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->index + 1 == job->nchunks;
+}
+
+static void
+map_release(struct job *job, struct chunk *c, size_t inlen, size_t outlen)
+{
+	/* the data is already in the output file */
+	unmapfile(&c->in);
+	unmapfile(&c->out);
+
+	/* mapped pages are not dropped, so unmap first */
+	cache_read(&job->incache, inlen);
+	cache_write(&job->outcache, outlen);
+}
+
+static int
+encrypt_map_write(void *arg, struct chunk *c)
+{
+	map_release((struct job *)arg, c, c->len, c->len+16);
+
+	return 0;
+}
+
+static const struct pool_ops encrypt_map_ops = {
+	.read = encrypt_map,
+	.process = encrypt_process,
+	.write = encrypt_map_write,
+};
+
+
+static int
+decrypt_map(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	uint64_t pos = c->index * (job->chunklen+16);
+	size_t n;
+
+	if (map_check(job) == -1)
+		return -1;
+
+	/* map_setup made sure every chunk has its mac */
+	n = MIN(job->chunklen+16, job->insize - pos);
+	c->len = n - 16;
+
+	if (mapfile(&c->in, fileno(job->in), job->inbase + pos, n, 0) == -1) {
+		warn("%s: can't map input file", job->inputfn);
+		return -1;
+	}
+	if (mapfile(&c->out, fileno(job->out),
+			job->outbase + c->index * job->chunklen,
+			c->len, 1) == -1) {
+		warn("%s: can't map output file", job->outputfn);
+		return -1;
+	}
+
+	c->src = c->in.data;
+	c->dst = c->out.data;
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->index + 1 == job->nchunks;
+}
+
+static int
+decrypt_map_process(void *wctx, struct chunk *c)
+{
+	struct cryptctx *ctx = (struct cryptctx *)wctx;
+
+	/*
+	 * check the mac before decrypting, so no unauthenticated plaintext
+	 * reaches the page cache of the output file.
+	 */
+	ctr_serpent_seek(&ctx->ctr, c->index * ctx->chunklen);
+
+	return ctr_poly1305_serpent_open(&ctx->ctr, &ctx->poly, c->nonce,
+			c->dst, c->src, c->len, c->src + c->len, ctx->split);
+}
+
+static int
+decrypt_map_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	/* the output is valid up to here */
+	job->written += c->len;
+	map_release(job, c, c->len+16, c->len);
+
+	return 0;
+}
+
+static int
+decrypt_map_store(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (job->sparse)
+		store_sparse(job, c->dst, c->len,
+				job->outbase + c->index * job->chunklen, 1);
+
+	return 0;
+}
+
+static const struct pool_ops decrypt_map_ops = {
+	.read = decrypt_map,
+	.process = decrypt_map_process,
+	.store = decrypt_map_store,
+	.write = decrypt_map_write,
+};
+
+
+/*
+ * chunk callbacks for direct i/o
+ *
+ * the chunk buffer is split into an input and an output area. the data
+ * is read into the input area and processed into the output area, both
+ * with the alignment their position in the file has.
+ */
+
+static int
+encrypt_direct_read(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	size_t half = c->buffer->len / 2;
+	ssize_t n;
+
+	n = direct_pread(fileno(job->in), c->buffer->data, job->readlen,
+			job->inbase + c->index * job->chunklen, &c->src);
+	/* a failed read may have filled any part of the input area */
+	buffer_touch(c->buffer, half);
+	if (n == -1) {
+		warn("%s: error reading file", job->inputfn);
+		return -1;
+	}
+
+	c->len = n;
+	c->dst = c->buffer->data + half
+		+ (job->outbase + c->index * (job->chunklen+16)) % DIRECT_ALIGN;
+	buffer_touch(c->buffer, c->dst - c->buffer->data + c->len+16);
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->len < job->chunklen;
+}
+
+static int
+encrypt_direct_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (direct_out_write(&job->dout, c->dst, c->len+16) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct pool_ops encrypt_direct_ops = {
+	.read = encrypt_direct_read,
+	.process = encrypt_process,
+	.write = encrypt_direct_write,
+};
+
+
+static int
+decrypt_direct_read(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	size_t half = c->buffer->len / 2;
+	ssize_t n;
+
+	n = direct_pread(fileno(job->in), c->buffer->data, job->readlen+16,
+			job->inbase + c->index * (job->chunklen+16), &c->src);
+	buffer_touch(c->buffer, half);
+	if (n == -1) {
+		warn("%s: can't read from input file", job->inputfn);
+		return -1;
+	}
+	if (n < 16) {
+		warnx("%s: incomplete chunk, file is damaged", job->inputfn);
+		return -1;
+	}
+
+	c->len = n - 16;
+	c->dst = c->buffer->data + half
+		+ (job->outbase + c->index * job->chunklen) % DIRECT_ALIGN;
+	buffer_touch(c->buffer, c->dst - c->buffer->data + c->len);
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->len < job->chunklen;
+}
+
+static int
+decrypt_direct_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	if (direct_out_write(&job->dout, c->dst, c->len) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct pool_ops decrypt_direct_ops = {
+	.read = decrypt_direct_read,
+	.process = decrypt_process,
+	.write = decrypt_direct_write,
+};
+
+static const struct pool_ops verify_direct_ops = {
+	.read = decrypt_direct_read,
+	.process = verify_process,
+	.write = verify_write,
+};
+
+
+/*
+ * direct_setup - switch input and output to O_DIRECT
+ *
+ * head holds everything written to the output so far. returns 0 if the
+ * direct callbacks can be used, -1 if we have to fall back to stdio.
+ */
+static int
+direct_setup(struct job *job, const uint8_t *head, size_t headlen)
+{
+	struct stat st;
+	off_t inpos, outpos = 0;
+	int flags;
+
+	if (fstat(fileno(job->in), &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+	inpos = ftello(job->in);
+	if (inpos == -1)
+		return -1;
+
+	if (job->out != NULL) {
+		if (fflush(job->out) == EOF)
+			return -1;
+		if (fstat(fileno(job->out), &st) == -1 || !S_ISREG(st.st_mode))
+			return -1;
+
+		/* pwrite ignores the offset with O_APPEND */
+		flags = fcntl(fileno(job->out), F_GETFL);
+		if (flags == -1 || (flags & O_APPEND))
+			return -1;
+
+		outpos = ftello(job->out);
+		if (outpos != headlen)
+			return -1;
+	}
+
+	if (direct_enable(fileno(job->in)) == -1)
+		return -1;
+
+	if (job->out != NULL) {
+		if (direct_enable(fileno(job->out)) == -1
+		    || direct_out_init(&job->dout, fileno(job->out), outpos,
+				head != NULL ? head + (outpos - outpos % DIRECT_ALIGN)
+				: NULL) == -1) {
+			direct_disable(fileno(job->out));
+			direct_disable(fileno(job->in));
+			return -1;
+		}
+	}
+
+	job->inbase = inpos;
+	job->outbase = outpos;
+
+	return 0;
+}
+
+/*
+ * direct_finish - write the last partial block, returns 0 or -1
+ */
+static int
+direct_finish(struct job *job)
+{
+	int rval = 0;
+
+	if (job->out == NULL)
+		return 0;
+
+	if (direct_out_finish(&job->dout) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
+		rval = -1;
+	}
+	direct_out_free(&job->dout);
+
+	return rval;
+}
+
+
+/*
+ * file_layout - find position and number of the chunks in regular files
+ *
+ * job->out may be NULL if there is no output. returns -1 if the files
+ * can't be accessed by offset.
+ */
+static int
+file_layout(struct job *job, int decrypt)
+{
+	struct stat st;
+	off_t inpos, outpos = 0;
+	int flags;
+
+	if (fstat(fileno(job->in), &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+
+	inpos = ftello(job->in);
+	if (inpos == -1 || inpos > st.st_size)
+		return -1;
+
+	job->inbase = inpos;
+	job->insize = st.st_size - inpos;
+
+	if (job->out != NULL) {
+		if (fflush(job->out) == EOF)
+			return -1;
+		if (fstat(fileno(job->out), &st) == -1 || !S_ISREG(st.st_mode))
+			return -1;
+
+		/* pwrite ignores the offset with O_APPEND */
+		flags = fcntl(fileno(job->out), F_GETFL);
+		if (flags == -1 || (flags & O_APPEND))
+			return -1;
+
+		outpos = ftello(job->out);
+		if (outpos == -1)
+			return -1;
+	}
+
+	job->outbase = outpos;
+	job->written = 0;
+
+	if (decrypt) {
+		/* let the stdio code report a damaged last chunk */
+		if (job->insize % (job->chunklen+16) < 16)
+			return -1;
+
+		job->nchunks = job->insize / (job->chunklen+16) + 1;
+		job->outsize = job->outbase + job->insize - 16 * job->nchunks;
+	} else {
+		job->nchunks = job->insize / job->chunklen + 1;
+		job->outsize = job->outbase + job->insize + 16 * job->nchunks;
+	}
+
+	return 0;
+}
+
+
+/* the job with mapped files, for map_sigbus */
+static const struct job	*mapjob;
+static int		 mapoutfd;
+static int		 mapdecrypt;
+
+/*
+ * map_sigbus - give up, a mapped file shrank while it was accessed
+ *
+ * only async signal safe calls here. as on other errors, a decrypted
+ * output is cut off after the last valid chunk.
+ */
+static void
+map_sigbus(int sig)
+{
+	static const char msg[] =
+		"sfet: a mapped file shrank while it was in use\n";
+	ssize_t rc;
+
+	(void)sig;
+
+	if (mapdecrypt)
+		rc = ftruncate(mapoutfd, mapjob->outbase + mapjob->written);
+	rc = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	(void)rc;
+
+	_exit(1);
+}
+
+/*
+ * map_setup - check if the files can be mapped and preallocate output
+ *
+ * returns 0 if the mapped callbacks can be used, -1 if we have to fall
+ * back to stdio.
+ */
+static int
+map_setup(struct job *job, int decrypt)
+{
+	struct sigaction sa;
+	int flags;
+
+	if (job->chunklen < MAP_MINCHUNK)
+		return -1;
+
+	if (file_layout(job, decrypt) == -1)
+		return -1;
+
+	/* a shared writable mapping needs read access, too */
+	flags = fcntl(fileno(job->out), F_GETFL);
+	if (flags == -1 || (flags & O_ACCMODE) != O_RDWR)
+		return -1;
+
+	if (preallocate(fileno(job->out), job->outsize) == -1)
+		return -1;
+
+	/* another process may truncate the files, don't just die then */
+	mapjob = job;
+	mapoutfd = fileno(job->out);
+	mapdecrypt = decrypt;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = map_sigbus;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGBUS, &sa, NULL) == -1)
+		return -1;
+
+	return 0;
+}
+
+
+
+/*
+ * chunk callbacks for writing in place
+ *
+ * the output file is preallocated and every worker writes its chunk to
+ * the computed offset as soon as it is done, in any order. the writer
+ * only keeps track of how much of the output is complete.
+ */
+
+static int
+encrypt_store(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	return pwrite_chunk(job, c->dst, c->len+16,
+			job->outbase + c->index * (job->chunklen+16));
+}
+
+static int
+encrypt_stored(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	job->written += c->len+16;
+	cache_write(&job->outcache, c->len+16);
+
+	return 0;
+}
+
+static const struct pool_ops encrypt_pwrite_ops = {
+	.read = encrypt_read,
+	.process = encrypt_process,
+	.store = encrypt_store,
+	.write = encrypt_stored,
+};
+
+
+static int
+decrypt_store(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	/* store is only called for authenticated chunks */
+	if (job->sparse)
+		return store_sparse(job, c->dst, c->len,
+				job->outbase + c->index * job->chunklen, 0);
+
+	return pwrite_chunk(job, c->dst, c->len,
+			job->outbase + c->index * job->chunklen);
+}
+
+static int
+decrypt_stored(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	/* the output is valid up to here */
+	job->written += c->len;
+	cache_write(&job->outcache, c->len);
+
+	return 0;
+}
+
+static const struct pool_ops decrypt_pwrite_ops = {
+	.read = decrypt_read,
+	.process = decrypt_process,
+	.store = decrypt_store,
+	.write = decrypt_stored,
+};
+
+
+/*
+ * pwrite_setup - check that we can write in place and preallocate
+ */
+static int
+pwrite_setup(struct job *job, int decrypt)
+{
+	if (file_layout(job, decrypt) == -1)
+		return -1;
+
+	/* chunks smaller than a block can only be holes in an empty file */
+	if (job->sparse && job->chunklen < SPARSE_BLOCK)
+		return 0;
+
+	/* without preallocation it still works, but not without space */
+	if (preallocate(fileno(job->out), job->outsize) == -1
+	    && errno == ENOSPC) {
+		warn("%s: can't preallocate output file", job->outputfn);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * pwrite_run - run the pool and cut the output after the valid part
+ */
+static int
+pwrite_run(const struct pool_ops *ops, struct job *job,
+	   const struct cryptctx *ctx, const struct config *conf)
+{
+	int rval;
+
+	if (conf->verbose > 0)
+		fprintf(stderr, "writing chunks in place\n");
+
+	rval = pool_run(ops, job, ctx, sizeof(struct cryptctx),
+			job->threads, job->run, job->readlen + 16);
+
+	/* drops chunks after a bad one and what the input was short of */
+	if (ftruncate(fileno(job->out), job->outbase + job->written) == -1) {
+		warn("%s: can't truncate output file", job->outputfn);
+		rval = -1;
+	}
+
+	/* leave the file offset behind the output, as writing would */
+	if (fseeko(job->out, 0, SEEK_END) == -1) {
+		warn("%s: can't seek in output file", job->outputfn);
+		rval = -1;
+	}
+
+	return rval;
+}
+
+
+/*
+ * size_job - fit buffers and threads to the input, if we know its size
+ *
+ * a regular file shorter than a chunk is read in one piece of its own
+ * size and needs no more than one thread. readlen is at most chunklen,
+ * the file is taken at the size it has now, like a mapped one.
+ *
+ * small chunks are given to the workers in runs, so one batch of
+ * one-time keys serves a whole run, see poly1305_serpent_batch.
+ */
+static void
+size_job(struct job *job, int decrypt, int threads)
+{
+	struct stat st;
+	off_t pos;
+	uint64_t left, nruns;
+
+	job->readlen = job->chunklen;
+	job->threads = threads;
+	job->run = 1;
+	if (threads > 1 && job->chunklen <= RUN_MAXCHUNK)
+		job->run = POLY1305_SERPENT_KEYS;
+
+	if (fstat(fileno(job->in), &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+
+	pos = ftello(job->in);
+	if (pos == -1 || pos > st.st_size)
+		return;
+	left = st.st_size - pos;
+
+	/* a stored chunk is 16 bytes longer, so is a truncated last one */
+	if (decrypt)
+		left = left > 16 ? left - 16 : 0;
+
+	nruns = (left / job->chunklen + job->run) / job->run;
+	if (nruns < (uint64_t)threads)
+		job->threads = nruns;
+	if (job->threads == 1)
+		job->run = 1;
+	if (left < job->chunklen)
+		job->readlen = left;
+}
+
+/*
+ * small_run - process an input of one small chunk on the stack
+ *
+ * for ops without store and asynchronous i/o. there is no thread, no
+ * buffer to allocate and no page cache handling, which would cost more
+ * than the crypto for a small file. main has locked this part of the
+ * stack.
+ */
+static int
+small_run(const struct pool_ops *ops, struct job *job, struct cryptctx *ctx)
+{
+	uint8_t data[SMALL_MAXLEN + 16];
+	struct buffer buffer;
+	struct chunk c;
+	int rval = -1;
+
+	buffer.len = sizeof(data);
+	buffer.data = data;
+	buffer.maplen = 0;
+	buffer.used = 0;
+
+	memset(&c, 0, sizeof(struct chunk));
+	c.buffer = &buffer;
+
+	cache_init(&job->incache, -1, 0);
+	cache_init(&job->outcache, -1, 0);
+	job->sparse = 0;
+
+	if (ops->read(job, &c) != -1) {
+		c.rval = ops->process(ctx, &c);
+		c.done = 1;
+		rval = ops->write(job, &c);
+	}
+
+	burn(data, buffer.used);
+
+	return rval;
+}
+
+
+
+/*
+ * bounded decryption, for chunks too large to be held in memory
+ *
+ * a chunk is read twice through a small window (per thread): the first
+ * pass only checks its mac, the second decrypts and writes it. the second
+ * pass computes the mac again, if the input changed between the passes
+ * the output of this chunk is cut off. so this only works with a seekable
+ * input and an output we can truncate.
+ *
+ * as every chunk is read twice and one after the other, this is only used
+ * if the chunk buffers of the pool would not fit into memory, or with
+ * --bounded.
+ */
+
+static int
+read_window(struct job *job, uint8_t *data, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fileno(job->in), data, len, off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			warn("%s: can't read from input file", job->inputfn);
+			return -1;
+		}
+		if (n == 0) {
+			warnx("%s: file is shorter than expected", job->inputfn);
+			return -1;
+		}
+
+		data += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+/*
+ * bounded_check - first pass, compute the mac of len bytes at off
+ */
+static int
+bounded_check(struct job *job, struct cryptctx *ctx, struct buffer *win,
+	      uint64_t off, uint64_t len, const uint8_t nonce[16],
+	      uint8_t mac[16])
+{
+	uint64_t pos;
+	size_t n;
+
+	poly1305_serpent_start(&ctx->poly, nonce);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = MIN(len - pos, win->len);
+
+		buffer_touch(win, n);
+		if (read_window(job, win->data, n, off + pos) == -1)
+			return -1;
+
+		ctr_poly1305_serpent_update(NULL, &ctx->poly, NULL, win->data,
+				n, CTR_POLY1305_MAC, ctx->split);
+	}
+
+	poly1305_serpent_final(&ctx->poly, mac);
+
+	return 0;
+}
+
+/*
+ * bounded_write - second pass, decrypt and write the part [lo, hi)
+ */
+static int
+bounded_write(struct job *job, struct cryptctx *ctx, struct buffer *win,
+	      uint64_t index, uint64_t off, uint64_t len,
+	      const uint8_t nonce[16], uint8_t mac[16])
+{
+	uint64_t pos, start, end;
+	size_t lo, hi, n;
+
+	clip(&job->range, index, job->chunklen, len, &lo, &hi);
+
+	poly1305_serpent_start(&ctx->poly, nonce);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = MIN(len - pos, win->len);
+
+		buffer_touch(win, n);
+		if (read_window(job, win->data, n, off + pos) == -1)
+			return -1;
+
+		start = pos > lo ? pos : lo;
+		end = pos + n < hi ? pos + n : hi;
+		if (start >= end) {
+			ctr_poly1305_serpent_update(NULL, &ctx->poly, NULL,
+					win->data, n, CTR_POLY1305_MAC, ctx->split);
+			continue;
+		}
+
+		/* the mac is only checked again, so decrypt in the same go */
+		ctr_serpent_seek(&ctx->ctr,
+				(job->range.first + index) * job->chunklen + start);
+		ctr_poly1305_serpent_update(NULL, &ctx->poly, NULL, win->data,
+				start - pos, CTR_POLY1305_MAC, ctx->split);
+		ctr_poly1305_serpent_update(&ctx->ctr, &ctx->poly,
+				win->data + (start - pos), win->data + (start - pos),
+				end - start, CTR_POLY1305_DECRYPT, ctx->split);
+		ctr_poly1305_serpent_update(NULL, &ctx->poly, NULL,
+				win->data + (end - pos), pos + n - end,
+				CTR_POLY1305_MAC, ctx->split);
+
+		if (job->sparse) {
+			if (fwrite_sparse(job, win->data + (start - pos),
+					end - start) == -1)
+				return -1;
+		} else if (fwrite(win->data + (start - pos), 1, end - start,
+				job->out) != end - start) {
+			warn("%s: can't write to output file", job->outputfn);
+			return -1;
+		}
+	}
+
+	poly1305_serpent_final(&ctx->poly, mac);
+
+	return 0;
+}
+
+/*
+ * memory_limit - how much memory the chunk buffers may take
+ *
+ * half of the physical memory, or less if the process is limited.
+ */
+static uint64_t
+memory_limit(void)
+{
+	struct rlimit rl;
+	uint64_t limit = UINT64_MAX;
+	long pages, pagesize;
+
+	pages = sysconf(_SC_PHYS_PAGES);
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && pagesize > 0)
+		limit = (uint64_t)pages * pagesize / 2;
+
+	if (getrlimit(RLIMIT_AS, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+	    && rl.rlim_cur < limit)
+		limit = rl.rlim_cur;
+	if (getrlimit(RLIMIT_DATA, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+	    && rl.rlim_cur < limit)
+		limit = rl.rlim_cur;
+
+	return limit;
+}
+
+/*
+ * bounded_setup - check if decrypt_bounded should and can be used
+ */
+static int
+bounded_setup(struct job *job, const struct config *conf)
+{
+	struct stat st;
+	uint64_t need, slots;
+	int flags;
+
+	if (!conf->bounded) {
+		/* the buffers pool_run would get on the path decrypt takes */
+		slots = job->threads * job->run + 2;
+		need = job->readlen + 16;
+		if (conf->offset == 0 && conf->length == 0) {
+			if (conf->direct)
+				need = 2*DIRECT_AREA(need);
+			else if (conf->uring > 0)
+				slots += 2 * (conf->uring - 1);
+		}
+		if (slots * need <= memory_limit())
+			return -1;
+	}
+
+	if (fstat(fileno(job->in), &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+
+	if (job->out == NULL)
+		return 0;
+
+	if (fstat(fileno(job->out), &st) == -1 || !S_ISREG(st.st_mode))
+		return -1;
+
+	/* with O_APPEND a cut off chunk would be written again behind */
+	flags = fcntl(fileno(job->out), F_GETFL);
+	if (flags == -1 || (flags & O_APPEND))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * bounded_notice - tell about options decrypt_bounded does not use
+ */
+static void
+bounded_notice(const struct config *conf)
+{
+	if (conf->direct)
+		warnx("decrypting in windows, ignoring --direct");
+	if (conf->uring > 0)
+		warnx("decrypting in windows, ignoring --uring");
+}
+
+/*
+ * decrypt_bounded - decrypt or verify all chunks with one small buffer
+ *
+ * used where the pool would need more memory for its chunk buffers than
+ * we have. with job->out NULL only the macs are checked.
+ */
+static int
+decrypt_bounded(struct job *job, struct cryptctx *ctx)
+{
+	cu_freebuffer struct buffer *win = NULL;
+	struct stat st;
+	uint8_t nonce[16], mac[16], check[16];
+	uint64_t index, off, len;
+	off_t inpos, outpos;
+
+	inpos = ftello(job->in);
+	if (inpos == -1 || fstat(fileno(job->in), &st) == -1) {
+		warn("%s: can't get input file size", job->inputfn);
+		return -1;
+	}
+
+	/* every thread working on the chunk gets its own window */
+	win = buffer_alloc(BOUNDED_WINDOW * ctx->split);
+	if (win == NULL) {
+		warn("can't allocate memory");
+		return -1;
+	}
+
+	off = inpos;
+	for (index = 0;; index++) {
+		if (off > st.st_size || st.st_size - off < 16) {
+			warnx("%s: incomplete chunk, file is damaged",
+					job->inputfn);
+			return -1;
+		}
+
+		len = st.st_size - off - 16;
+		if (len > job->chunklen)
+			len = job->chunklen;
+
+		memcpy(nonce, job->nonce, 16);
+		next_nonce(job->nonce);
+
+		if (bounded_check(job, ctx, win, off, len, nonce, check) == -1
+		    || read_window(job, mac, 16, off + len) == -1)
+			return -1;
+
+		if (!ctiseq(mac, check, 16)) {
+			warnx("%s: WARNING, file was modified!", job->inputfn);
+			return -1;
+		}
+
+		if (job->out != NULL) {
+			outpos = ftello(job->out);
+			if (outpos == -1) {
+				warn("%s: can't get output file position",
+						job->outputfn);
+				return -1;
+			}
+
+			if (bounded_write(job, ctx, win, index, off, len,
+					nonce, check) == -1)
+				return -1;
+
+			if (!ctiseq(mac, check, 16)) {
+				warnx("%s: WARNING, file was modified while "
+						"decrypting!", job->inputfn);
+				if (fflush(job->out) == EOF
+				    || ftruncate(fileno(job->out), outpos) == -1
+				    || fseeko(job->out, outpos, SEEK_SET) == -1)
+					warn("%s: can't truncate output file",
+							job->outputfn);
+				return -1;
+			}
+		}
+
+		/* stop after the last chunk of the file or of a range */
+		if (len < job->chunklen || (job->left > 0 && --job->left == 0))
+			break;
+
+		off += len + 16;
+	}
+
+	return 0;
+}
+
 
 
+#ifdef USE_IO_URING
+/*
+ * chunk callbacks for io_uring
+ *
+ * read and write only submit the request to the ring of the reader or
+ * the writer thread, so up to depth chunks are in flight on each side.
+ */
 
-static void
-printhex(FILE *fp, const uint8_t *vec, size_t n)
+static int
+uring_setup(void *arg, struct chunk *ring, int nslots)
 {
+	struct job *job = (struct job *)arg;
+	struct iovec iov[POOL_MAXTHREADS + 2*URING_MAXDEPTH];
 	int i;
 
-        if (n > 0) {
-                for (i = 0; i < n; i++)
-                        fprintf(fp, "%02x", vec[i]);
-	} else
-                fputc('-', fp);
+	for (i = 0; i < nslots; i++) {
+		iov[i].iov_base = ring[i].buffer->data;
+		iov[i].iov_len = ring[i].buffer->len;
+	}
 
-        fputc('\n', fp);
+	if (aio_register(&job->rio, iov, nslots) == -1
+	    || (job->out != NULL && aio_register(&job->wio, iov, nslots) == -1)) {
+		warn("can't set up buffers for io_uring");
+		return -1;
+	}
+
+	return 0;
 }
 
+static int
+uring_read_wait(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	ssize_t n;
+
+	n = aio_wait(&job->rio, c->slot);
+	if (n == -1) {
+		warn("%s: can't read from input file", job->inputfn);
+		return -1;
+	}
+	if (n != c->want) {
+		warnx("%s: file is shorter than expected", job->inputfn);
+		return -1;
+	}
 
-static void
-printusage(FILE *fp)
+	return 0;
+}
+
+static int
+uring_write_wait(void *arg, struct chunk *c)
 {
-	fprintf(fp, "decrypt:\tsfet [-d] [-vf] [-p <fn>] [<input>] [<output>]\n");
-	fprintf(fp, "encrypt:\tsfet -e [-vf] [-p <fn>] [-i <iter>] [-c <length>] [<input>] [<output>]\n");
-	fprintf(fp, "show metadata:\tsfet -s [-v] [<input>]\n");
-	fprintf(fp, "\n");
-	fprintf(fp, "options:\n");
-	fprintf(fp, "  -v\t\tincrease verbosity level\n");
-	fprintf(fp, "  -f\t\toverwrite outputfile, if it already exists\n");
-	fprintf(fp, "  -p <file>\tread password from <file> instead of %s\n", PASSWD_SRC);
-	fprintf(fp, "  -i <n>\tset pbkdf2 iteration number to <n>, encryption only\n");
-	fprintf(fp, "  -c <length>\tset chunk size to <length>, encryption only\n");
-	fprintf(fp, "  -V\t\tshow version\n");
-	fprintf(fp, "  -h\t\tshow this help message\n");
+	struct job *job = (struct job *)arg;
+
+	if (aio_wait(&job->wio, c->slot) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
+		return -1;
+	}
+
+	return 0;
 }
 
-static void
-printversion(FILE *fp)
+
+static int
+encrypt_uring_read(void *arg, struct chunk *c)
 {
-	fprintf(fp, "sfet %s, file version: %d\n", VERSION, FILEVER);
+	struct job *job = (struct job *)arg;
+	uint64_t pos = c->index * job->chunklen;
+
+	/* the buffers only hold readlen bytes, see size_job */
+	c->len = MIN(job->readlen, job->insize - pos);
+	c->want = c->len;
+	c->src = c->dst = c->buffer->data;
+	buffer_touch(c->buffer, c->len+16);
+
+	if (aio_submit(&job->rio, c->slot, c->src, c->want,
+			job->inbase + pos) == -1) {
+		warn("%s: can't read from input file", job->inputfn);
+		return -1;
+	}
 
-#if defined(USE_ASM_X86_64) || defined(USE_ASM_AVX)
-	fprintf(fp, "build with: ");
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
 
-#ifdef USE_ASM_X86_64
-	fprintf(fp, "ASM-X86-64 ");
-#endif
-#ifdef USE_ASM_AVX
-	fprintf(fp, "AVX ");
-#endif
-	fprintf(fp, "\n");
-#endif
+	return c->index + 1 == job->nchunks;
 }
 
 static int
-parse_chunklen(uint64_t *out, const char *str)
+encrypt_uring_write(void *arg, struct chunk *c)
 {
-	char *endp;
-	long long int n;
+	struct job *job = (struct job *)arg;
 
-	n = strtoll(str, &endp, 10);
-	if (n <= 0 || n == LONG_MAX)
+	if (aio_submit(&job->wio, c->slot, c->dst, c->len+16,
+			job->outbase + c->index * (job->chunklen+16)) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
 		return -1;
+	}
 
-	switch (*endp) {
-	case '\0':
-		*out = n;
-		break;
-	case 'k': case 'K':
-		*out = (uint64_t)n * 1024;
-		break;
-	case 'm': case 'M':
-		*out = (uint64_t)n * 1024 * 1024;
-		break;
-	case 'g': case 'G':
-		*out = (uint64_t)n * 1024 * 1024 * 1024;
-		break;
-	default:
+	return 0;
+}
+
+static const struct pool_ops encrypt_uring_ops = {
+	.read = encrypt_uring_read,
+	.process = encrypt_process,
+	.write = encrypt_uring_write,
+	.setup = uring_setup,
+	.read_wait = uring_read_wait,
+	.write_wait = uring_write_wait,
+};
+
+
+static int
+decrypt_uring_read(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+	uint64_t pos = c->index * (job->chunklen+16);
+
+	/* file_layout made sure every chunk has its mac */
+	c->want = MIN(job->readlen+16, job->insize - pos);
+	c->len = c->want - 16;
+	c->src = c->dst = c->buffer->data;
+	buffer_touch(c->buffer, c->want);
+
+	if (aio_submit(&job->rio, c->slot, c->src, c->want,
+			job->inbase + pos) == -1) {
+		warn("%s: can't read from input file", job->inputfn);
+		return -1;
+	}
+
+	memcpy(c->nonce, job->nonce, 16);
+	next_nonce(job->nonce);
+
+	return c->index + 1 == job->nchunks;
+}
+
+static int
+decrypt_uring_write(void *arg, struct chunk *c)
+{
+	struct job *job = (struct job *)arg;
+
+	if (c->rval != 0) {
+		warnx("%s: WARNING, file was modified!", job->inputfn);
+		return -1;
+	}
+
+	if (aio_submit(&job->wio, c->slot, c->dst, c->len,
+			job->outbase + c->index * job->chunklen) == -1) {
+		warn("%s: can't write to output file", job->outputfn);
 		return -1;
 	}
 
 	return 0;
 }
 
+static const struct pool_ops decrypt_uring_ops = {
+	.read = decrypt_uring_read,
+	.process = decrypt_process,
+	.write = decrypt_uring_write,
+	.setup = uring_setup,
+	.read_wait = uring_read_wait,
+	.write_wait = uring_write_wait,
+};
 
-static inline void
-next_nonce(uint8_t nonce[16])
+static const struct pool_ops verify_uring_ops = {
+	.read = decrypt_uring_read,
+	.process = verify_process,
+	.write = verify_write,
+	.setup = uring_setup,
+	.read_wait = uring_read_wait,
+};
+
+
+/*
+ * uring_start - set up the rings, returns -1 if io_uring can't be used
+ */
+static int
+uring_start(struct job *job, int decrypt, int depth)
 {
-	int i;
-	for (i = 15; i >= 0 && ++nonce[i] == 0; i--);
+	if (file_layout(job, decrypt) == -1)
+		return -1;
+
+	/* a request length is only 32 bit */
+	if (job->readlen + 16 > UINT32_MAX)
+		return -1;
+
+	if (aio_init(&job->rio, fileno(job->in), 0, depth) == -1)
+		return -1;
+
+	if (job->out != NULL
+	    && aio_init(&job->wio, fileno(job->out), 1, depth) == -1) {
+		aio_free(&job->rio);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+uring_stop(struct job *job)
+{
+	aio_free(&job->rio);
+	if (job->out != NULL)
+		aio_free(&job->wio);
+}
+
+/*
+ * uring_run - process all chunks with io_uring
+ *
+ * returns 0 on success, -1 on error and 1 if io_uring can't be used for
+ * these files.
+ */
+static int
+uring_run(const struct pool_ops *tmpl, struct job *job,
+	  const struct cryptctx *ctx, const struct config *conf, int decrypt)
+{
+	struct pool_ops ops = *tmpl;
+	int rval;
+
+	if (uring_start(job, decrypt, conf->uring) == -1)
+		return 1;
+
+	if (conf->verbose > 0)
+		fprintf(stderr, "using io_uring, queue depth: %d\n", conf->uring);
+
+	ops.depth = conf->uring;
+	rval = pool_run(&ops, job, ctx, sizeof(struct cryptctx),
+			job->threads, job->run, job->readlen + 16);
+
+	uring_stop(job);
+
+	return rval;
 }
+#endif /* USE_IO_URING */
 
 
 
@@ -157,17 +1917,15 @@ encrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 	cu_fclose FILE *in = stdin;
 	cu_fclose FILE *out = stdout;
 
-	cu_freebuffer struct buffer *buffer = NULL;
-
 	struct header header;
-	size_t n;
+	uint8_t headmac[16];
+	uint8_t head[sizeof(struct header) + 16];
+	int rval;
 
-	uint8_t passwd[PASSLEN];
-	uint8_t key[32+32]; /* 32 serpent ctr + 32 poly1305-serpent */
 	uint8_t nonce[16];
 
-	struct ctr_serpent ctrctx;
-	struct poly1305_serpent polyctx;
+	cu_secfree struct secrets *sec = NULL;
+	struct job job;
 
 
 	/* open input file */
@@ -179,8 +1937,15 @@ encrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 		}
 	}
 
+	/* password and keys are kept in locked memory */
+	sec = secmem_alloc(sizeof(struct secrets));
+	if (sec == NULL) {
+		warn("can't allocate locked memory");
+		return 1;
+	}
+
 	/* read password (read_pass_fn is verbose) */
-	if (read_pass_fn(conf->passfn, passwd, sizeof(passwd),
+	if (read_pass_fn(conf->passfn, sec->passwd, sizeof(sec->passwd),
 			"Password: ", "Confirm: ") == -1)
 		return 1;
 
@@ -194,28 +1959,23 @@ encrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 	if (conf->verbose > 0) {
 		fprintf(stderr, "chunk length: %" PRIu64 "\n", conf->chunklen);
 		fprintf(stderr, "iterations: %" PRIu64 "\n", conf->iterations);
+		fprintf(stderr, "threads: %d\n", conf->threads);
+		fprintf(stderr, "backend: %s\n", backend->name);
 		fprintf(stderr, "nonce: ");
 		printhex(stderr, nonce, 16);
 	}
 
-	pbkdf2_hmac_sha512(key, sizeof(key), passwd, PASSLEN, nonce, 16, conf->iterations);
-
-	ctr_serpent_init(&ctrctx, key);
-	ctr_serpent_nonce(&ctrctx, nonce);
-	poly1305_serpent_setkey(&polyctx, key+32);
+	pbkdf2_hmac_sha512(sec->key, sizeof(sec->key), sec->passwd, PASSLEN, nonce, 16, conf->iterations);
 
-
-	/* allocate chunk buffer */
-	buffer = buffer_alloc(conf->chunklen + 16);
-	if (buffer == NULL) {
-		warn("can't allocate memory");
-		return 1;
-	}
+	ctr_serpent_init(&sec->ctx.ctr, sec->key);
+	ctr_serpent_nonce(&sec->ctx.ctr, nonce);
+	poly1305_serpent_setkey(&sec->ctx.poly, sec->key+32);
+	sec->ctx.chunklen = conf->chunklen;
 
 
 	/* open output file */
 	if (strcmp(outputfn, "-") != 0) {
-		out = fopen(outputfn, conf->force ? "w" : "wx");
+		out = fopen(outputfn, conf->force ? "w+" : "w+x");
 		if (out == NULL) {
 			warn("%s: can't open output file", outputfn);
 			return 1;
@@ -229,37 +1989,118 @@ encrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 	header.iter = htobe64(conf->iterations);
 	memcpy(header.nonce, nonce, 16);
 	header.chunklen = htobe64(conf->chunklen);
-	memcpy(buffer->data, &header, sizeof(struct header));
 
 	/* authenticate and write header */
-	poly1305_serpent_authdata(&polyctx, buffer->data, sizeof(struct header),
-			nonce, buffer->data+sizeof(struct header));
+	poly1305_serpent_authdata(&sec->ctx.poly, (uint8_t*)&header, sizeof(struct header),
+			nonce, headmac);
 	next_nonce(nonce);
 
-	if (fwrite(buffer->data, sizeof(struct header)+16, 1, out) != 1) {
+	if (fwrite(&header, sizeof(struct header), 1, out) != 1
+	    || fwrite(headmac, 16, 1, out) != 1) {
 		warn("%s: can't write to output file", outputfn);
 		return 1;
 	}
 
-	/* encryption loop */
-	do {
-		n = fread(buffer->data, 1, conf->chunklen, in);
+	/* encrypt all chunks */
+	job.in = in;
+	job.out = out;
+	job.inputfn = inputfn;
+	job.outputfn = outputfn;
+	job.chunklen = conf->chunklen;
+	job.sparse = 0;
+	memcpy(job.nonce, nonce, 16);
+	size_job(&job, 0, conf->threads);
+
+	/* threads the pool can't use work inside the chunks */
+	sec->ctx.split = conf->threads / job.threads;
+
+	/* a single worker gets the chunks in order */
+	poly1305_serpent_batch(&sec->ctx.poly,
+			job.threads == 1 || job.run > 1);
+
+	if (conf->direct) {
+		memcpy(head, &header, sizeof(struct header));
+		memcpy(head + sizeof(struct header), headmac, 16);
+
+		if (direct_setup(&job, head, sizeof(head)) == 0) {
+			if (conf->verbose > 0)
+				fprintf(stderr, "using direct i/o\n");
+
+			rval = pool_run(&encrypt_direct_ops, &job, &sec->ctx,
+					sizeof(sec->ctx), job.threads, job.run,
+					2*DIRECT_AREA(job.readlen+16));
+			if (direct_finish(&job) == -1)
+				rval = -1;
+
+			return rval == -1 ? 1 : 0;
+		}
+
+		warnx("direct i/o not possible, using the page cache");
+	}
+
+#ifdef USE_IO_URING
+	if (conf->uring > 0) {
+		rval = uring_run(&encrypt_uring_ops, &job, &sec->ctx, conf, 0);
+		if (rval != 1)
+			return rval == -1 ? 1 : 0;
+
+		warnx("can't use io_uring for these files");
+	}
+#endif
+
+	if (job.readlen < job.chunklen && job.readlen <= SMALL_MAXLEN)
+		return small_run(&encrypt_ops, &job, &sec->ctx) == -1;
 
-		ctr_serpent_crypt(&ctrctx, buffer->data, buffer->data, n);
+	cache_start(&job, conf);
 
-		poly1305_serpent_authdata(&polyctx, buffer->data, n, nonce, buffer->data+n);
-		next_nonce(nonce);
+	if (map_setup(&job, 0) == 0) {
+		if (conf->verbose > 0)
+			fprintf(stderr, "using mapped files\n");
 
-		if (fwrite(buffer->data, 1, n+16, out) != n+16) {
-			warn("%s: can't write to output file", outputfn);
+		if (pool_run(&encrypt_map_ops, &job, &sec->ctx, sizeof(sec->ctx),
+				job.threads, job.run, 0) == -1)
 			return 1;
-		}
-	} while (n == conf->chunklen);
 
-	/* check for reading error */
-	if (ferror(in)) {
-		warn("%s: error reading file", inputfn);
+		return 0;
+	}
+
+	if (pwrite_setup(&job, 0) == 0)
+		return pwrite_run(&encrypt_pwrite_ops, &job, &sec->ctx, conf) == -1;
+
+	pipe_start(&job, job.readlen, job.readlen+16);
+
+	if (pool_run(&encrypt_ops, &job, &sec->ctx, sizeof(sec->ctx),
+			job.threads, job.run, job.readlen + 16) == -1)
 		return 1;
+
+	return 0;
+}
+
+
+/*
+ * seek_chunk - position input file at chunk number index
+ */
+static int
+seek_chunk(FILE *in, const char *inputfn, uint64_t index, uint64_t chunklen)
+{
+	struct stat st;
+	uint64_t pos;
+
+	if (index > (uint64_t)(INT64_MAX / 2) / (chunklen + 16)) {
+		warnx("%s: offset beyond end of file", inputfn);
+		return -1;
+	}
+	pos = sizeof(struct header) + 16 + index * (chunklen + 16);
+
+	if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)
+	    && pos >= st.st_size) {
+		warnx("%s: offset beyond end of file", inputfn);
+		return -1;
+	}
+
+	if (fseeko(in, pos, SEEK_SET) == -1) {
+		warn("%s: can't seek in input file", inputfn);
+		return -1;
 	}
 
 	return 0;
@@ -271,20 +2112,19 @@ decrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 {
 	cu_fclose FILE *in = stdin;
 	cu_fclose FILE *out = stdout;
-	
-	cu_freebuffer struct buffer *buffer = NULL;
 
 	struct header header;
 	size_t n;
 	uint8_t mac[16], check[16];
 	uint64_t chunklen;
+	struct range range;
+	uint64_t left;
+	int rval;
 
-	uint8_t passwd[PASSLEN];
-	uint8_t key[32+32]; /* 32 serpent ctr + 32 poly1305-serpent */
 	uint8_t nonce[16];
 
-	struct ctr_serpent ctrctx;
-	struct poly1305_serpent polyctx;
+	cu_secfree struct secrets *sec = NULL;
+	struct job job;
 
 
 	/* open input file */
@@ -320,8 +2160,15 @@ decrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 	chunklen = be64toh(header.chunklen);
 
 
+	/* password and keys are kept in locked memory */
+	sec = secmem_alloc(sizeof(struct secrets));
+	if (sec == NULL) {
+		warn("can't allocate locked memory");
+		return 1;
+	}
+
 	/* read password */
-	if (read_pass_fn(conf->passfn, passwd, sizeof(passwd),
+	if (read_pass_fn(conf->passfn, sec->passwd, sizeof(sec->passwd),
 			"Password: ", NULL) == -1)
 		return 1;	/* read_pass_fn is verbose */
 
@@ -330,15 +2177,18 @@ decrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 	if (conf->verbose > 0) {
 		fprintf(stderr, "chunk length: %" PRIu64 "\n", chunklen);
 		fprintf(stderr, "iterations: %" PRIu64 "\n", be64toh(header.iter));
+		fprintf(stderr, "threads: %d\n", conf->threads);
+		fprintf(stderr, "backend: %s\n", backend->name);
 		fprintf(stderr, "nonce: ");
 		printhex(stderr, nonce, 16);
 	}
 
-	pbkdf2_hmac_sha512(key, sizeof(key), passwd, PASSLEN, nonce, 16, be64toh(header.iter));
+	pbkdf2_hmac_sha512(sec->key, sizeof(sec->key), sec->passwd, PASSLEN, nonce, 16, be64toh(header.iter));
 
-	ctr_serpent_init(&ctrctx, key);
-	ctr_serpent_nonce(&ctrctx, nonce);
-	poly1305_serpent_setkey(&polyctx, key+32);
+	ctr_serpent_init(&sec->ctx.ctr, sec->key);
+	ctr_serpent_nonce(&sec->ctx.ctr, nonce);
+	poly1305_serpent_setkey(&sec->ctx.poly, sec->key+32);
+	sec->ctx.chunklen = chunklen;
 
 
 	/* read and check header mac */
@@ -350,7 +2200,7 @@ decrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 
 		return 1;
 	}
-	poly1305_serpent_authdata(&polyctx,
+	poly1305_serpent_authdata(&sec->ctx.poly,
 			(uint8_t*)&header, sizeof(struct header),
 			nonce, check);
 	next_nonce(nonce);
@@ -358,62 +2208,182 @@ decrypt(const char *inputfn, const char *outputfn, const struct config *conf)
 		warnx("%s: corrupt header or wrong password", inputfn);
 		return 1;
 	}
+	if (chunklen == 0) {
+		warnx("%s: corrupt header, chunk length is 0", inputfn);
+		return 1;
+	}
+	if (chunklen > MAX_CHUNKLEN) {
+		warnx("%s: chunk length too large: %" PRIu64, inputfn, chunklen);
+		return 1;
+	}
 
+	/* go straight to the chunks covering the range */
+	range.first = conf->offset / chunklen;
+	range.offset = conf->offset;
+	range.end = UINT64_MAX;
+	left = 0;
 
-	/* allocate chunk buffer */
-	buffer = buffer_alloc(chunklen + 16);
-	if (buffer == NULL) {
-		warn("can't allocate memory");
-		return 1;
+	if (conf->length > 0) {
+		if (conf->length <= UINT64_MAX - conf->offset)
+			range.end = conf->offset + conf->length;
+		left = (range.end - 1) / chunklen - range.first + 1;
+	}
+
+	if (range.first > 0) {
+		if (seek_chunk(in, inputfn, range.first, chunklen) == -1)
+			return 1;
+		add_nonce(nonce, range.first);
 	}
 
+	sec->ctx.range = range;
+
 
 	/* open output file */
-	if (strcmp(outputfn, "-") != 0) {
-		out = fopen(outputfn, conf->force ? "w" : "wx");
+	if (!conf->testonly && strcmp(outputfn, "-") != 0) {
+		out = fopen(outputfn, conf->force ? "w+" : "w+x");
 		if (out == NULL) {
 			warn("%s: can't open output file", outputfn);
 			return 1;
 		}
 	}
 
-	/* decryption loop */
-	do {
-		n = fread(buffer->data, 1, chunklen+16, in);
-		if (n < 16) {
-			/* is this an error or is the file damaged? */
-			if (ferror(in))
-				warn("%s: can't read from input file", inputfn);
-			else
-				warnx("%s: incomplete chunk, file is damaged", inputfn);
-
+	/* decrypt or verify all chunks */
+	job.in = in;
+	job.out = out;
+	job.inputfn = inputfn;
+	job.outputfn = outputfn;
+	job.chunklen = chunklen;
+	memcpy(job.nonce, nonce, 16);
+	job.range = range;
+	job.left = left;
+	size_job(&job, 1, conf->threads);
+	sec->ctx.split = conf->threads / job.threads;
+	poly1305_serpent_batch(&sec->ctx.poly,
+			job.threads == 1 || job.run > 1);
+
+	if (conf->testonly)
+		job.out = NULL;
+
+	if (bounded_setup(&job, conf) == 0) {
+		bounded_notice(conf);
+		if (conf->verbose > 0)
+			fprintf(stderr, "decrypting in windows\n");
+
+		cache_start(&job, conf);
+		job.sparse = sparse_start(&job);
+
+		/* one chunk at a time, so all threads work on it */
+		sec->ctx.split = conf->threads;
+		poly1305_serpent_batch(&sec->ctx.poly, 1);
+		rval = decrypt_bounded(&job, &sec->ctx);
+		if (job.sparse && sparse_finish(&job) == -1)
+			rval = -1;
+		if (rval == -1)
 			return 1;
+
+		if (conf->testonly && conf->verbose > 0)
+			fprintf(stderr, "%s: ok\n", inputfn);
+		return 0;
+	}
+	job.out = out;
+
+	if (conf->direct && conf->offset == 0 && conf->length == 0) {
+		if (conf->testonly)
+			job.out = NULL;
+
+		if (direct_setup(&job, NULL, 0) == 0) {
+			if (conf->verbose > 0)
+				fprintf(stderr, "using direct i/o\n");
+
+			rval = pool_run(conf->testonly ? &verify_direct_ops
+					: &decrypt_direct_ops, &job,
+					&sec->ctx, sizeof(sec->ctx), job.threads,
+					job.run, 2*DIRECT_AREA(job.readlen+16));
+
+			/* the data written so far is authenticated */
+			if (direct_finish(&job) == -1)
+				rval = -1;
+			if (rval == -1)
+				return 1;
+
+			if (conf->testonly && conf->verbose > 0)
+				fprintf(stderr, "%s: ok\n", inputfn);
+			return 0;
 		}
 
-		/* set n to the data length in this chunk */
-		n -= 16;
+		warnx("direct i/o not possible, using the page cache");
+		job.out = out;
+	}
 
-		poly1305_serpent_authdata(&polyctx, buffer->data, n, nonce, check);
-		next_nonce(nonce);
-		if (!ctiseq(buffer->data+n, check, 16)) {
-			warnx("%s: WARNING, file was modified!", inputfn);
-			return 1;
+#ifdef USE_IO_URING
+	if (conf->uring > 0 && conf->offset == 0 && conf->length == 0) {
+		if (conf->testonly)
+			job.out = NULL;
+
+		rval = uring_run(conf->testonly ? &verify_uring_ops
+				: &decrypt_uring_ops, &job, &sec->ctx, conf, 1);
+		if (rval != 1) {
+			if (rval == -1)
+				return 1;
+			if (conf->testonly && conf->verbose > 0)
+				fprintf(stderr, "%s: ok\n", inputfn);
+			return 0;
 		}
 
-		ctr_serpent_crypt(&ctrctx, buffer->data, buffer->data, n);
+		warnx("can't use io_uring for these files");
+		job.out = out;
+	}
+#endif
+
+	if (conf->testonly)
+		job.out = NULL;
+
+	if (job.readlen < job.chunklen && job.readlen <= SMALL_MAXLEN) {
+		if (small_run(conf->testonly ? &verify_ops : &decrypt_ops,
+				&job, &sec->ctx) == -1)
+			return 1;
+
+		if (conf->testonly && conf->verbose > 0)
+			fprintf(stderr, "%s: ok\n", inputfn);
+		return 0;
+	}
+
+	cache_start(&job, conf);
+	job.sparse = sparse_start(&job);
 
-		if (fwrite(buffer->data, 1, n, out) != n) {
-			warn("%s: can't write to output file", outputfn);
+	if (!conf->testonly && conf->offset == 0 && conf->length == 0
+	    && map_setup(&job, 1) == 0) {
+		if (conf->verbose > 0)
+			fprintf(stderr, "using mapped files\n");
+
+		if (pool_run(&decrypt_map_ops, &job, &sec->ctx, sizeof(sec->ctx),
+				job.threads, job.run, 0) == -1) {
+			/* cut off everything after the last valid chunk */
+			if (ftruncate(fileno(out), job.outbase + job.written) == -1)
+				warn("%s: can't truncate output file", outputfn);
 			return 1;
 		}
-	} while (n == chunklen);
 
-	/* check for input error */
-	if (ferror(in)) {
-		warn("%s: can't read from input file", inputfn);
-		return 1;
+		return 0;
 	}
-	
+
+	if (!conf->testonly && conf->offset == 0 && conf->length == 0
+	    && pwrite_setup(&job, 1) == 0)
+		return pwrite_run(&decrypt_pwrite_ops, &job, &sec->ctx, conf) == -1;
+
+	pipe_start(&job, job.readlen+16, job.readlen);
+
+	rval = pool_run(conf->testonly ? &verify_ops : &decrypt_ops, &job,
+			&sec->ctx, sizeof(sec->ctx), job.threads, job.run,
+			job.readlen + 16);
+	if (job.sparse && sparse_finish(&job) == -1)
+		rval = -1;
+	if (rval == -1)
+		return 1;
+
+	if (conf->testonly && conf->verbose > 0)
+		fprintf(stderr, "%s: ok\n", inputfn);
+
 	return 0;
 }
 
@@ -491,6 +2461,7 @@ show(const char *inputfn, const struct config *conf)
 
 		do {
 			n = fread(buffer->data, 1, chunklen+16, in);
+			buffer_touch(buffer, n);
 			if (n < 16) {
 				if (feof(in))
 					warnx("%s: file too short, can't read chunk", inputfn);
@@ -524,8 +2495,19 @@ main(int argc, char *argv[])
 
 	struct config conf;
 	int option;
+	int range = 0;
 	int rval = 1;
 
+	static const struct option longopts[] = {
+		{ "offset",	required_argument,	NULL,	'O' },
+		{ "length",	required_argument,	NULL,	'L' },
+		{ "direct",	no_argument,		NULL,	'D' },
+		{ "keep-cache",	no_argument,		NULL,	'K' },
+		{ "uring",	required_argument,	NULL,	'U' },
+		{ "bounded",	no_argument,		NULL,	'B' },
+		{ NULL,		0,			NULL,	0 }
+	};
+
 	enum {
 		MODE_ENCRYPT,
 		MODE_DECRYPT,
@@ -551,22 +2533,38 @@ main(int argc, char *argv[])
 		err(1, "can't disable core dumps");
 #endif
 
-	/* lock memory */
-	if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1)
+	/*
+	 * secrets are kept in locked memory (see secmem.c), this covers the
+	 * stack below us, where pbkdf2 and friends keep their state.
+	 */
+	if (lockstack(16) == -1)
 		err(1, "can't lock memory");
 
+	/* choose crypto routines for this cpu */
+	if (backend_init(getenv("SFET_BACKEND")) == -1)
+		exit(1);
+
 	/* set default config values */
 	conf.verbose = 0;
 	conf.force = 0;
+	conf.threads = 1;
+	conf.testonly = 0;
+	conf.direct = 0;
+	conf.keepcache = 0;
+	conf.uring = 0;
+	conf.bounded = 0;
 	conf.iterations = ITERATIONS;
 	conf.chunklen = CHUNKLEN;
 	conf.passfn = PASSWD_SRC;
+	conf.offset = 0;
+	conf.length = 0;
 
 	mode = MODE_DECRYPT;
 
 
 	/* parse parameters */
-	while ((option = getopt(argc, argv, "hVedsvfi:c:p:")) != -1) {
+	while ((option = getopt_long(argc, argv, "hVedtsvfi:c:p:j:",
+				     longopts, NULL)) != -1) {
 		switch (option) {
 
 		/* options */
@@ -586,11 +2584,46 @@ main(int argc, char *argv[])
 			conf.passfn = optarg;
 			break;
 
+		case 'j':
+			conf.threads = atoi(optarg);
+			break;
+
 		case 'c':
-			if (parse_chunklen(&conf.chunklen, optarg) == -1)
+			if (parse_size(&conf.chunklen, optarg) == -1)
 				errx(1, "illegal chunk length: %s", optarg);
 			break;
 
+		case 'O':
+			if (parse_size(&conf.offset, optarg) == -1)
+				errx(1, "illegal offset: %s", optarg);
+			range = 1;
+			break;
+
+		case 'D':
+			conf.direct = 1;
+			break;
+
+		case 'K':
+			conf.keepcache = 1;
+			break;
+
+		case 'B':
+			conf.bounded = 1;
+			break;
+
+		case 'U':
+			conf.uring = atoi(optarg);
+			if (conf.uring < 1 || conf.uring > URING_MAXDEPTH)
+				errx(1, "illegal queue depth: %s", optarg);
+			break;
+
+		case 'L':
+			if (parse_size(&conf.length, optarg) == -1
+			    || conf.length == 0)
+				errx(1, "illegal length: %s", optarg);
+			range = 1;
+			break;
+
 		/* main modes */
 		case 'h':
 			printusage(stdout);
@@ -605,6 +2638,12 @@ main(int argc, char *argv[])
 
 		case 'd':
 			mode = MODE_DECRYPT;
+			conf.testonly = 0;
+			break;
+
+		case 't':
+			mode = MODE_DECRYPT;
+			conf.testonly = 1;
 			break;
 
 		case 's':
@@ -624,15 +2663,36 @@ main(int argc, char *argv[])
 	/* check parameter */
 	if (argc > 0)
 		inputfn = argv[0];
-	if (argc > 1)
+	if (argc > 1) {
+		if (conf.testonly)
+			errx(1, "no output file in test mode: %s", argv[1]);
 		outputfn = argv[1];
+	}
 
 	if (conf.iterations < 1024)
 		errx(1, "illegal number of pbkdf2 iterations: %" PRIu64,
 				conf.iterations);
 
+	if (range && mode != MODE_DECRYPT)
+		errx(1, "--offset and --length only work with decryption");
+
+	if (conf.bounded && mode != MODE_DECRYPT)
+		errx(1, "--bounded only works with decryption");
+
+	if (conf.threads < 1 || conf.threads > POOL_MAXTHREADS)
+		errx(1, "illegal number of threads: %d", conf.threads);
+
+#ifndef USE_IO_URING
+	if (conf.uring > 0) {
+		warnx("compiled without io_uring support, ignoring --uring");
+		conf.uring = 0;
+	}
+#endif
+
 	if (conf.chunklen < sizeof(struct header))
 		errx(1, "chunk size too small: %" PRIu64, conf.chunklen);
+	if (conf.chunklen > MAX_CHUNKLEN)
+		errx(1, "chunk size too large: %" PRIu64, conf.chunklen);
 
 	/* early warning if output file already exists... */
 	if (strcmp(outputfn, "-") != 0) {
@@ -654,7 +2714,7 @@ main(int argc, char *argv[])
 	}
 		 
 	/* cleanup stack */
-	burnstack(64);
+	burnstack(64 * 1024);
 
 	return rval;
 }
@@ -9,6 +9,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "sha512.h"
 #include "utils.h"
@@ -188,3 +189,34 @@ sha512_done(sha512ctx *ctx, uint8_t out[64])
 	for (i = 0; i < 8; i++)
 		store_be64(out + 8*i, ctx->state[i]);
 }
+
+
+/*
+ * sha512_final64 - append exactly 64 bytes and finish the hash
+ *
+ * this is a short cut for hmac, where the inner and the outer hash always
+ * end with one 64 byte block after the key block. ctx must not hold any
+ * buffered data and is not modified, so it can be used again.
+ */
+void
+sha512_final64(const sha512ctx *ctx, const uint8_t data[64], uint8_t out[64])
+{
+	uint64_t state[8];
+	uint8_t block[128];
+	int i;
+
+	memcpy(block, data, 64);
+	block[64] = 0x80;
+	memset(block + 65, 0, 112-65);
+
+	store_be64(block+112, ctx->count >> 54);
+	store_be64(block+120, ((ctx->count << 7) | 64) << 3);
+
+	for (i = 0; i < 8; i++)
+		state[i] = ctx->state[i];
+
+	compress(state, block);
+
+	for (i = 0; i < 8; i++)
+		store_be64(out + 8*i, state[i]);
+}
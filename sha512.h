@@ -22,6 +22,9 @@ void sha512_init(sha512ctx *ctx);
 void sha512_update(sha512ctx *ctx, const void *data, size_t len);
 void sha512_done(sha512ctx *ctx, uint8_t out[SHA512_HASH_LENGTH]);
 
+void sha512_final64(const sha512ctx *ctx, const uint8_t data[64],
+		    uint8_t out[SHA512_HASH_LENGTH]);
+
 
 
 #endif
@@ -0,0 +1,110 @@
+/*
+ * sparse - find all zero blocks, so they can become holes in the output
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "sparse.h"
+
+
+/*
+ * iszero - check if len bytes are all zero
+ *
+ * a line of 64 bytes is or'ed together and tested at once, we stop at
+ * the first line that is not zero.
+ */
+int
+iszero(const uint8_t *data, size_t len)
+{
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x;
+
+	for (; len >= 64; data += 64, len -= 64) {
+		x = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)data),
+				_mm_loadu_si128((const __m128i *)(data + 16))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *)(data + 32)),
+				_mm_loadu_si128((const __m128i *)(data + 48))));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+			return 0;
+	}
+#else
+	uint64_t w[8];
+
+	for (; len >= 64; data += 64, len -= 64) {
+		memcpy(w, data, 64);
+
+		if (w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7])
+			return 0;
+	}
+#endif
+
+	for (; len > 0; data++, len--)
+		if (*data != 0)
+			return 0;
+
+	return 1;
+}
+
+
+/*
+ * sparse_run - get the run of zero blocks or data at the start of data
+ *
+ * off is the file offset of data, the blocks are aligned in the file. the
+ * first and last block may be partial, as their rest belongs to another
+ * write. returns the length of the run and sets *zero for zero blocks.
+ */
+size_t
+sparse_run(const uint8_t *data, size_t len, uint64_t off, int *zero)
+{
+	size_t pos, n;
+	int z, bz;
+
+	for (z = -1, pos = 0; pos < len; pos += n) {
+		n = SPARSE_BLOCK - (off + pos) % SPARSE_BLOCK;
+		if (n > len - pos)
+			n = len - pos;
+
+		bz = iszero(data + pos, n);
+		if (z == -1)
+			z = bz;
+		else if (bz != z)
+			break;
+	}
+
+	*zero = (z == 1);
+
+	return pos;
+}
+
+
+/*
+ * punch_hole - deallocate len bytes at off, they read as zeros afterwards
+ */
+int
+punch_hole(int fd, uint64_t off, uint64_t len)
+{
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			off, len);
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
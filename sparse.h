@@ -0,0 +1,16 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * holes are made of whole blocks of this size, aligned in the file
+ */
+#define SPARSE_BLOCK	4096
+
+int	iszero(const uint8_t *data, size_t len);
+size_t	sparse_run(const uint8_t *data, size_t len, uint64_t off, int *zero);
+int	punch_hole(int fd, uint64_t off, uint64_t len);
+
+#endif
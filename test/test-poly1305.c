@@ -20,6 +20,41 @@ const struct {
 const int table_num = sizeof(table) / sizeof(table[0]);
 
 
+/*
+ * compute the mac of msg with every block aligned split point
+ */
+static int
+test_append(struct poly1305 *poly, const uint8_t *msg, size_t len,
+	    const uint8_t r[16], const uint8_t encno[16], const uint8_t mac[16])
+{
+	const uint8_t zero[16] = { 0 };
+	struct poly1305 seg;
+	uint8_t check[16];
+	size_t cut;
+
+	for (cut = 0; cut <= len; cut += 16) {
+		poly1305_setkey(poly, r);
+		poly1305_init(poly, encno);
+		poly1305_update(poly, msg, cut);
+
+		poly1305_setkey(&seg, r);
+		poly1305_init(&seg, zero);
+		poly1305_update(&seg, msg + cut, len - cut);
+
+		poly1305_append(poly, &seg, (len - cut) / 16);
+		poly1305_mac(poly, check);
+
+		if (memcmp(check, mac, 16) != 0) {
+			printvec("is", check, 16);
+			printvec("should", mac, 16);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
 int main()
 {
 	struct poly1305 poly;
@@ -44,6 +79,29 @@ int main()
 			printvec("should", table[i].mac, 16);
 			return 1;
 		}
+
+#ifdef USE_ASM_AVX2
+		/* same with avx2, split to test the partial block handling */
+		poly1305_setkey_avx2(&poly, table[i].r);
+		poly1305_init(&poly, table[i].encno);
+		poly1305_update_avx2(&poly, table[i].msg, i/3);
+		poly1305_update_avx2(&poly, table[i].msg + i/3, i - i/3);
+		poly1305_mac(&poly, check);
+
+		if (memcmp(check, table[i].mac, 16) != 0) {
+			fprintf(stderr, "poly1305-selftest: avx2 test number %d failed\n", i+1);
+			printvec("is", check, 16);
+			printvec("should", table[i].mac, 16);
+			return 1;
+		}
+#endif
+
+		/* in two parts, joined with poly1305_append */
+		if (!test_append(&poly, &table[i].msg[0], i, table[i].r,
+				table[i].encno, table[i].mac)) {
+			fprintf(stderr, "poly1305-selftest: append test number %d failed\n", i+1);
+			return 1;
+		}
 	}
 
 	return 0;
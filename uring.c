@@ -0,0 +1,360 @@
+/*
+ * uring - minimal io_uring interface, just enough to read and write
+ * files, with registered buffers if we may pin them
+ *
+ * we talk to the kernel directly, so there is no dependency on liburing.
+ * the rings are not shared between threads.
+ */
+
+#ifdef __linux
+  #define _GNU_SOURCE
+  #define _FILE_OFFSET_BITS	64
+#endif
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "uring.h"
+
+
+#define load_acquire(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+static int
+sys_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, complete, flags,
+		       NULL, 0);
+}
+
+static int
+sys_register(int fd, unsigned opcode, const void *arg, unsigned n)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+
+int
+uring_init(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(r, 0, sizeof(struct uring));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = sys_setup(entries, &p);
+	if (r->fd == -1)
+		return -1;
+
+	r->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	sq = mmap(NULL, r->sqmaplen, PROT_READ|PROT_WRITE,
+		  MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	r->sqmap = sq;
+
+	cq = mmap(NULL, r->cqmaplen, PROT_READ|PROT_WRITE,
+		  MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED)
+		goto fail;
+	r->cqmap = cq;
+
+	r->sqes = mmap(NULL, r->sqeslen, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sqhead = (unsigned *)(sq + p.sq_off.head);
+	r->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	r->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sqarray = (unsigned *)(sq + p.sq_off.array);
+
+	r->cqhead = (unsigned *)(cq + p.cq_off.head);
+	r->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	r->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	uring_free(r);
+	return -1;
+}
+
+
+void
+uring_free(struct uring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqeslen);
+	if (r->cqmap)
+		munmap(r->cqmap, r->cqmaplen);
+	if (r->sqmap)
+		munmap(r->sqmap, r->sqmaplen);
+	if (r->fd >= 0)
+		close(r->fd);
+
+	memset(r, 0, sizeof(struct uring));
+	r->fd = -1;
+}
+
+
+/*
+ * uring_register - register the buffers for fixed reads and writes
+ */
+int
+uring_register(struct uring *r, const struct iovec *iov, unsigned n)
+{
+	return sys_register(r->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+
+/*
+ * uring_queue - queue a read or write of a buffer
+ *
+ * bufidx is the index of the registered buffer. with bufidx -1 the buffer
+ * is not registered, buf then points to one struct iovec describing it,
+ * which has to stay valid until the request is done.
+ *
+ * the request is submitted with the next uring_wait. returns -1 if the
+ * submission queue is full.
+ */
+int
+uring_queue(struct uring *r, int write, int fd, void *buf, size_t len,
+	    uint64_t off, int bufidx, uint64_t tag)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *r->sqtail;
+	if (tail - load_acquire(r->sqhead) >= *r->sqmask + 1) {
+		errno = EBUSY;
+		return -1;
+	}
+	idx = tail & *r->sqmask;
+
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	if (bufidx >= 0) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED
+			: IORING_OP_READ_FIXED;
+		sqe->addr = (uintptr_t)buf;
+		sqe->len = len;
+		sqe->buf_index = bufidx;
+	} else {
+		sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (uintptr_t)buf;
+		sqe->len = 1;
+	}
+	sqe->fd = fd;
+	sqe->off = off;
+	sqe->user_data = tag;
+
+	r->sqarray[idx] = idx;
+	store_release(r->sqtail, tail + 1);
+	r->pending++;
+
+	return 0;
+}
+
+
+/*
+ * uring_wait - submit queued requests and wait for one completion
+ *
+ * res is the result of the read or write, a negative errno on failure.
+ */
+int
+uring_wait(struct uring *r, uint64_t *tag, int32_t *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+	int n;
+
+	for (;;) {
+		head = *r->cqhead;
+		if (head != load_acquire(r->cqtail)) {
+			cqe = &r->cqes[head & *r->cqmask];
+			*tag = cqe->user_data;
+			*res = cqe->res;
+			store_release(r->cqhead, head + 1);
+			return 0;
+		}
+
+		n = sys_enter(r->fd, r->pending, 1, IORING_ENTER_GETEVENTS);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		r->pending -= n;
+	}
+}
+
+
+
+/*
+ * aio - one request per buffer, completions are collected until somebody
+ * waits for them
+ */
+
+struct aioreq {
+	uint8_t		*buf;
+	size_t		 len;
+	uint64_t	 off;
+	struct iovec	 iov;		/* without registered buffers */
+
+	int		 busy;		/* submitted, not waited for */
+	int		 done;		/* completion seen */
+	int32_t		 res;
+};
+
+
+int
+aio_init(struct aio *a, int fd, int write, unsigned depth)
+{
+	a->fd = fd;
+	a->write = write;
+	a->nbufs = 0;
+	a->fixed = 0;
+	a->req = NULL;
+
+	return uring_init(&a->ring, depth);
+}
+
+/*
+ * aio_register - set up the nbufs buffers of iov
+ *
+ * registered buffers count against RLIMIT_MEMLOCK. if they can't be
+ * registered, they are passed with every request instead.
+ */
+int
+aio_register(struct aio *a, const struct iovec *iov, int nbufs)
+{
+	a->req = calloc(nbufs, sizeof(struct aioreq));
+	if (a->req == NULL)
+		return -1;
+	a->nbufs = nbufs;
+
+	a->fixed = (uring_register(&a->ring, iov, nbufs) == 0);
+
+	return 0;
+}
+
+void
+aio_free(struct aio *a)
+{
+	uring_free(&a->ring);
+	free(a->req);
+	a->req = NULL;
+}
+
+
+/*
+ * aio_submit - start reading or writing len bytes of buffer bufidx
+ */
+int
+aio_submit(struct aio *a, int bufidx, uint8_t *buf, size_t len, uint64_t off)
+{
+	struct aioreq *req = &a->req[bufidx];
+
+	req->buf = buf;
+	req->len = len;
+	req->off = off;
+	req->busy = 1;
+	req->done = 0;
+
+	/* nothing to do for an empty request */
+	if (len == 0) {
+		req->done = 1;
+		req->res = 0;
+		return 0;
+	}
+
+	if (a->fixed)
+		return uring_queue(&a->ring, a->write, a->fd, buf, len, off,
+				   bufidx, bufidx);
+
+	req->iov.iov_base = buf;
+	req->iov.iov_len = len;
+	return uring_queue(&a->ring, a->write, a->fd, &req->iov, len, off,
+			   -1, bufidx);
+}
+
+
+/*
+ * aio_wait - wait for the request of buffer bufidx
+ *
+ * a short transfer is completed synchronously, so this returns less than
+ * requested only for a read at the end of file. returns -1 on error.
+ */
+ssize_t
+aio_wait(struct aio *a, int bufidx)
+{
+	struct aioreq *req = &a->req[bufidx];
+	uint64_t tag;
+	int32_t res;
+	size_t total;
+	ssize_t n;
+
+	if (!req->busy) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (!req->done) {
+		if (uring_wait(&a->ring, &tag, &res) == -1)
+			return -1;
+		if (tag >= a->nbufs)
+			continue;
+
+		a->req[tag].done = 1;
+		a->req[tag].res = res;
+	}
+	req->busy = 0;
+
+	if (req->res < 0) {
+		errno = -req->res;
+		return -1;
+	}
+
+	for (total = req->res; total < req->len; total += n) {
+		if (a->write)
+			n = pwrite(a->fd, req->buf + total, req->len - total,
+				   req->off + total);
+		else
+			n = pread(a->fd, req->buf + total, req->len - total,
+				  req->off + total);
+		if (n == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0)
+			break;
+	}
+
+	return total;
+}
@@ -0,0 +1,74 @@
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * largest queue depth we accept
+ */
+#define URING_MAXDEPTH	64
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * a minimal io_uring, used by one thread only
+ */
+struct uring {
+	int			 fd;
+
+	/* submission queue */
+	void			*sqmap;
+	size_t			 sqmaplen;
+	unsigned		*sqhead;
+	unsigned		*sqtail;
+	unsigned		*sqmask;
+	unsigned		*sqarray;
+	struct io_uring_sqe	*sqes;
+	size_t			 sqeslen;
+	unsigned		 pending;	/* queued, but not submitted */
+
+	/* completion queue */
+	void			*cqmap;
+	size_t			 cqmaplen;
+	unsigned		*cqhead;
+	unsigned		*cqtail;
+	unsigned		*cqmask;
+	struct io_uring_cqe	*cqes;
+};
+
+int	uring_init(struct uring *r, unsigned entries);
+void	uring_free(struct uring *r);
+
+int	uring_register(struct uring *r, const struct iovec *iov, unsigned n);
+
+int	uring_queue(struct uring *r, int write, int fd, void *buf,
+		    size_t len, uint64_t off, int bufidx, uint64_t tag);
+int	uring_wait(struct uring *r, uint64_t *tag, int32_t *res);
+
+
+/*
+ * reads or writes of one file, one request per registered buffer
+ */
+struct aio {
+	struct uring	 ring;
+	int		 fd;
+	int		 write;
+
+	int		 nbufs;
+	int		 fixed;		/* buffers are registered */
+	struct aioreq	*req;		/* one per buffer */
+};
+
+int	aio_init(struct aio *a, int fd, int write, unsigned depth);
+int	aio_register(struct aio *a, const struct iovec *iov, int nbufs);
+void	aio_free(struct aio *a);
+
+int	aio_submit(struct aio *a, int bufidx, uint8_t *buf, size_t len,
+		   uint64_t off);
+ssize_t	aio_wait(struct aio *a, int bufidx);
+
+#endif